@@ -11,7 +11,9 @@ typedef enum
  {
    eButtonStatus_None = 0,
    eButtonStatus_Pressed,
-   eButtonStatus_Released  
+   eButtonStatus_Released,
+   eButtonStatus_Long,    //Still pressed after duration
+   eButtonStatus_Double   //Pressed again just after a short press
  } tButtonStatus;
  
 void ControlsSetup();
@@ -30,4 +32,5 @@ int ControlsRegisterButtonCallback(byte button, tButtonStatus event, int duratio
 int ControlsRegisterKnobCallback(byte knob, tKnobCb callback);
 
 void ControlsNotifyKnob(byte knob); //Force callback for knob 
+int  ControlsKnobValue(byte knob);  //Last value given to callbacks (0-1023), to init without notifying
 
@@ -9,36 +9,55 @@
 -- Buttons :
 On emet un signal différent pour press et release
 A l'enregistrement de cb, on peut préciser press/release et préciser un temps de release-press
+
+All buttons are sampled at once, with one read of their port (PIND), every BUTTON_DELAY ms.
+Debounce is done on the packed bits with vertical counters : a button changes state once read
+BUTTON_DEBOUNCE times in a row in its new state (4 samples : 20ms).
+Events sent to callbacks :
+  - Pressed
+  - Released : only callbacks with the longest duration reached are called (short press callbacks
+    are not called on a long press)
+  - Long : button held for duration, called while still pressed. A press that called a Long callback
+    calls no Released callback of a shorter duration : the long press action has been done
+  - Double : second press within BUTTON_DOUBLE ms of a short press (first press events are sent too)
 */
 
 /***********************************
  *     Buttons configuration
  ***********************************/
-#define BUTTON_DELAY  50                     //delay between buttons value check
-#define BUTTON_MAX_CB 2                      //max number of registered cb for buttons
+#define BUTTON_DELAY  5                      //delay between buttons value check
+#define BUTTON_DOUBLE 300                    //Max delay between release and next press for a double press
+#define BUTTON_MAX_CB 3                      //max number of registered cb for buttons (short, long and double press)
 #define BUTTON_COUNT  3                      //Number of buttons in config
 byte aButtonPins[BUTTON_COUNT] = {2, 3, 4};  //pins used for buttons in config    //TODO : parameter for ButtonsSetup ?
+#define BUTTON_PORT   PIND                   //Port of button pins (D0-D7)...
+#define BUTTON_SHIFT  2                      //...which must follow each other, from this bit
+#define BUTTON_MASK   ((1 << BUTTON_COUNT) - 1)
 
 
 
 typedef struct
 {
-  tButtonStatus event;     //Press or Release
+  byte          event;     //tButtonStatus (1 byte : BUTTON_MAX_CB per button)
   int           duration; //For how long ?
   tButtonCb     callback;  //Cb
 } tButtonCallback;
 
 typedef struct
 {
-  byte              pin;
-  tButtonStatus     btStatus;
   int               timePressed;
+  int               timeReleased; //Last short press release (double press detection)
+  int               held;         //Press duration at previous check (long press detection)
   tButtonCallback   aCallbacks[BUTTON_MAX_CB];
 } tButton;
 
 
 tButton aButtons[BUTTON_COUNT];
 int lastButtonChecked = 0;
+byte buttonsState;           //Debounced state, 1 bit per button (1 : pressed)
+byte buttonsCount0;          //Vertical counters : bit 0...
+byte buttonsCount1;          //... and bit 1 of each button's counter
+byte buttonsDouble;          //Buttons released from a short press, waiting for a double press
 
 
 void ControlsSetupButtons(int time)
@@ -49,71 +68,114 @@ void ControlsSetupButtons(int time)
   for (i = 0; i < BUTTON_COUNT; i++)
   {
     memset(&aButtons[i], 0x00, sizeof(tButton));
-    aButtons[i].btStatus   = eButtonStatus_Released;
-    aButtons[i].pin       = aButtonPins[i];
-    pinMode((int) aButtons[i].pin, INPUT_PULLUP);
-    memset(&aButtons[i].aCallbacks, 0x00, (BUTTON_MAX_CB+1)*sizeof(tButtonCallback));
+    pinMode((int) aButtonPins[i], INPUT_PULLUP);
   }
+  buttonsState  = 0;
+  buttonsCount0 = 0xFF;
+  buttonsCount1 = 0xFF;
+  buttonsDouble = 0;
   lastButtonChecked = time;
 }
 
+//Calls button's callbacks registered for event (and duration)
+void ButtonNotify(byte i, tButtonStatus event, int duration)
+{
+  byte j;
+
+  for (j = 0; (j < BUTTON_MAX_CB) && aButtons[i].aCallbacks[j].callback; j++)
+  {
+    tButtonCallback * cb = &aButtons[i].aCallbacks[j];
+
+    if ((cb->event == event) && (cb->duration == duration))
+      cb->callback(i, event, duration);
+  }
+}
+
+//Longest duration of Released callbacks reached by a press (-1 : none, or a longer Long callback was called)
+int ButtonReleaseDuration(byte i, int timePressed)
+{
+  int best = -1;
+  boolean done = false; //Long callback called
+  byte j;
+
+  for (j = 0; (j < BUTTON_MAX_CB) && aButtons[i].aCallbacks[j].callback; j++)
+  {
+    tButtonCallback * cb = &aButtons[i].aCallbacks[j];
+
+    if ((cb->event == eButtonStatus_Released) && (cb->duration > best) && (!cb->duration || (cb->duration < timePressed)))
+    {
+      best = cb->duration;
+      done = false;
+    }
+    else if ((cb->event == eButtonStatus_Long) && (cb->duration > best) && (cb->duration <= aButtons[i].held)) //Called while held
+    {
+      best = cb->duration;
+      done = true;
+    }
+  }
+  return done ? -1 : best;
+}
+
 void ControlsUpdateButtons(int time)
 {
-  int i;
+  byte i, changed, bit;
   //Update Buttons
   
   if (time - lastButtonChecked < BUTTON_DELAY)  //Too early for a new check
     return;
   lastButtonChecked = time;
 
-  
-  for (i = 0; i < BUTTON_COUNT; i++)
+  //Debounce : counters of unchanged buttons are reset, others count down (4 samples), state toggles on roll over
+  changed = buttonsState ^ (~(BUTTON_PORT >> BUTTON_SHIFT) & BUTTON_MASK); //Pressed : low
+  buttonsCount0 = ~(buttonsCount0 & changed);
+  buttonsCount1 = buttonsCount0 ^ (buttonsCount1 & changed);
+  changed &= buttonsCount0 & buttonsCount1;
+  buttonsState ^= changed;
+
+  for (i = 0, bit = 1; i < BUTTON_COUNT; i++, bit <<= 1)
   {
-    tButtonStatus btVal = (digitalRead(aButtons[i].pin) == HIGH)?eButtonStatus_Released:eButtonStatus_Pressed;
-   
-    if (aButtons[i].btStatus != btVal) //button has changed
+    tButton * bt = &aButtons[i];
+
+    if (changed & bit)
     {
-      int j;
       DisplayBlinkGreen();
-
-      tButtonStatus st = eButtonStatus_None;
-      int timePressed = 0;
-        
-      if ( (aButtons[i].btStatus == eButtonStatus_Pressed) && //Release
-           (btVal == eButtonStatus_Released) )
-      {
-        timePressed = time - aButtons[i].timePressed;
-        aButtons[i].btStatus = eButtonStatus_Released;
-        st = eButtonStatus_Released;
-      }
-      else //Press
+      if (buttonsState & bit) //Press
       {
-        aButtons[i].timePressed = time;
-        aButtons[i].btStatus = eButtonStatus_Pressed;
-        st = eButtonStatus_Pressed;
+        bt->timePressed = time;
+        bt->held = 0;
+        ButtonNotify(i, eButtonStatus_Pressed, 0);
+        if ((buttonsDouble & bit) && (time - bt->timeReleased < BUTTON_DOUBLE))
+          ButtonNotify(i, eButtonStatus_Double, 0);
+        buttonsDouble &= ~bit;
       }
-        
-      //Process callbacks for this button
-      j = 0;
-      while ((j < BUTTON_MAX_CB) && aButtons[i].aCallbacks[j].callback)
+      else //Release
       {
-        if (aButtons[i].aCallbacks[j].event == st)
+        int timePressed = time - bt->timePressed;
+        int duration = ButtonReleaseDuration(i, timePressed);
+
+        if (duration >= 0)
+          ButtonNotify(i, eButtonStatus_Released, duration);
+        if (timePressed < BUTTON_DOUBLE)
         {
-          if (st == eButtonStatus_Pressed)
-          {
-            aButtons[i].aCallbacks[j].callback(i, aButtons[i].aCallbacks[j].event, aButtons[i].aCallbacks[j].duration);
-          }
-          else
-          {
-            if (!aButtons[i].aCallbacks[j].duration) //no duration specified
-              aButtons[i].aCallbacks[j].callback(i, aButtons[i].aCallbacks[j].event, aButtons[i].aCallbacks[j].duration);
-            else if (aButtons[i].aCallbacks[j].duration < timePressed)
-              aButtons[i].aCallbacks[j].callback(i, aButtons[i].aCallbacks[j].event, aButtons[i].aCallbacks[j].duration);
-          }              
+          buttonsDouble |= bit;
+          bt->timeReleased = time;
         }
-        j++;
       }
     }
+    else if (buttonsState & bit) //Held : long press callbacks reached since previous check
+    {
+      int held = time - bt->timePressed;
+      byte j;
+
+      for (j = 0; (j < BUTTON_MAX_CB) && bt->aCallbacks[j].callback; j++)
+      {
+        tButtonCallback * cb = &bt->aCallbacks[j];
+
+        if ((cb->event == eButtonStatus_Long) && (bt->held < cb->duration) && (cb->duration <= held))
+          cb->callback(i, eButtonStatus_Long, cb->duration);
+      }
+      bt->held = held;
+    }
   }
 }
 
@@ -123,11 +185,13 @@ void ControlsUpdateButtons(int time)
 int ControlsRegisterButtonCallback(byte button, tButtonStatus event, int duration, tButtonCb callback)
 {
   int i;
-  if ((button < 0) || (button >= BUTTON_COUNT))
+  if (button >= BUTTON_COUNT)
     return -1;
   
-  if ((event == eButtonStatus_Pressed) && (duration))
+  if ((event != eButtonStatus_Released) && (event != eButtonStatus_Long) && (duration))
     return -1; // invalid settings
+  if ((event == eButtonStatus_Long) && (!duration))
+    return -1;
     
   for (i = 0; i < BUTTON_MAX_CB; i++)
   {
@@ -135,14 +199,12 @@ int ControlsRegisterButtonCallback(byte button, tButtonStatus event, int duratio
     {
       aButtons[button].aCallbacks[i].callback = callback;
       aButtons[button].aCallbacks[i].event = event;
-      if (event == eButtonStatus_Released)
-        aButtons[button].aCallbacks[i].duration = duration;
+      aButtons[button].aCallbacks[i].duration = duration;
 
       return 0;
     }
   }
   
-  return -1; //Too many cb for this knob (increase KNOB_MAX_CB)
+  return -1; //Too many cb for this button (increase BUTTON_MAX_CB)
 }
 
-
@@ -8,16 +8,25 @@ A chaque loop, on regarde si on a regardé il y a longtemps et si sup a un seuil
 On calcule un delta pour dire si CW ou CCW
 TODO : calibrer les boutons voir établir un max (0-1024 ?)
 
+Knobs are sampled in background by the ADC interrupt : conversions are started by Timer0 overflow
+(~1kHz, the millis() timer), each conversion result is filtered into aKnobFiltered and the next
+knob channel is selected. Knob updates only read filtered values : no analogRead wait.
+Callbacks are called once a knob moved more than KNOB_HYSTERESIS from its last reported value
+(noise does not trigger them).
+
 */
 
 #include "Arduino.h"
 #include "Controls.h"
+#include <avr/interrupt.h>
 
 
 /***********************************
  *     Knobs configuration
  ***********************************/
-#define KNOB_DELAY 100                 //delay between knobs value check
+#define KNOB_DELAY 20                  //delay between knobs value check
+#define KNOB_HYSTERESIS 8              //Min change of value to notify callbacks (0-1023)
+#define KNOB_FILTER 3                  //Filter : 1/8 of new conversion
 #define KNOB_MAX_CB 2                  //max number of registered cb for knobs
 #define KNOB_COUNT 2                   //Number of knobs in config
 byte aKnobPins[KNOB_COUNT] = {0, 1};   //pins used for knobs in config
@@ -37,6 +46,23 @@ typedef struct
 tKnob aKnobs[KNOB_COUNT];
 int lastKnobsChecked = 0;
 
+//Written by ADC interrupt only
+volatile unsigned int aKnobFiltered[KNOB_COUNT];  //Filtered values (<< KNOB_FILTER)
+volatile byte knobConverting;                     //Knob being converted
+
+#define KNOB_ADMUX(_k) (_BV(REFS0) | (aKnobPins[_k] & 0x07)) //AVcc reference (as analogRead)
+
+//Filtered value of a knob (0-1023)
+int KnobValue(byte knob)
+{
+  unsigned int v;
+
+  noInterrupts(); //16 bits value shared with interrupt
+  v = aKnobFiltered[knob];
+  interrupts();
+  return v >> KNOB_FILTER;
+}
+
 void ControlsSetupKnobs(int time)
 {
   int i;
@@ -48,9 +74,29 @@ void ControlsSetupKnobs(int time)
     aKnobs[i].curValue = analogRead(aKnobs[i].pin);
     aKnobs[i].prevValue = aKnobs[i].curValue;
     aKnobs[i].lastChange = time;
-    memset(&aKnobs[i].aCallbacks, 0x00, (KNOB_MAX_CB+1)*sizeof(tKnobCb));
+    aKnobFiltered[i] = aKnobs[i].curValue << KNOB_FILTER;
+    DIDR0 |= _BV(aKnobPins[i]); //Analog only : no digital input buffer
   }
   lastKnobsChecked = time;
+
+  //Conversions started on Timer0 overflow, interrupt on completion
+  knobConverting = 0;
+  ADMUX  = KNOB_ADMUX(0);
+  ADCSRB = _BV(ADTS2);
+  ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0); //125kHz ADC clock
+}
+
+//Conversion done : filter it, next conversion is for next knob
+ISR(ADC_vect)
+{
+  byte k = knobConverting;
+  unsigned int f = aKnobFiltered[k];
+
+  aKnobFiltered[k] = f - (f >> KNOB_FILTER) + ADC;
+  if (++k == KNOB_COUNT)
+    k = 0;
+  knobConverting = k;
+  ADMUX = KNOB_ADMUX(k);
 }
 
 void ControlsUpdateKnobs(int time)
@@ -63,13 +109,16 @@ void ControlsUpdateKnobs(int time)
   
   for (i = 0; i < KNOB_COUNT; i++)
   {
-    aKnobs[i].prevValue = aKnobs[i].curValue;
-    aKnobs[i].curValue = analogRead(aKnobs[i].pin);
+    int value = KnobValue(i);
 
-    //Change
-    if (aKnobs[i].prevValue != aKnobs[i].curValue)
+    //Change (ends of course are always reported)
+    if ((abs(value - aKnobs[i].curValue) > KNOB_HYSTERESIS) ||
+        ((value != aKnobs[i].curValue) && ((value == 0) || (value == 1023))))
     {
       int j = 0;
+
+      aKnobs[i].prevValue = aKnobs[i].curValue;
+      aKnobs[i].curValue = value;
       
       //Orientation
       if (aKnobs[i].prevValue < aKnobs[i].curValue)
@@ -91,7 +140,7 @@ void ControlsUpdateKnobs(int time)
 int ControlsRegisterKnobCallback(byte knob, tKnobCb callback)
 {
   int i;
-  if ((knob < 0) || (knob >= KNOB_COUNT))
+  if (knob >= KNOB_COUNT)
     return -1;
   
   
@@ -109,7 +158,7 @@ int ControlsRegisterKnobCallback(byte knob, tKnobCb callback)
 void ControlsNotifyKnob(byte knob)
 {
   int j = 0;
-  if ((knob < 0) || (knob >= KNOB_COUNT))
+  if (knob >= KNOB_COUNT)
     return ;
     
   while ((j < KNOB_MAX_CB) && (aKnobs[knob].aCallbacks[j] != NULL))
@@ -118,3 +167,10 @@ void ControlsNotifyKnob(byte knob)
     j ++;
   }
 }
+
+int ControlsKnobValue(byte knob)
+{
+  if (knob >= KNOB_COUNT)
+    return 0;
+  return aKnobs[knob].curValue;
+}
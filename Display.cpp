@@ -10,11 +10,37 @@ LiquidCrystal lcd(5, 8, 9, 10, 11, 12); //RS, Enable, d0, d1, d2, d3
 int redTime   = 0;
 int greenTime = 0;
 
+void DisplaySend(byte count);
+
+//Screen contents are written in a frame, sent to the LCD by DisplayUpdate, a few changed cells at a time
+//Changed cells are flagged in a bit mask (one bit per cell) : no copy of the LCD contents is kept
+#define DISPLAY_COLS    16
+#define DISPLAY_LINES   2
+#define DISPLAY_CELLS   (DISPLAY_COLS*DISPLAY_LINES)
+#define DISPLAY_FLUSH   4     //Max cells sent per DisplayUpdate call (~0.1ms each)
+#define DISPLAY_NOWHERE 0xFF  //LCD cursor position unknown
+
+byte aFrame[DISPLAY_CELLS];  //Wanted contents
+unsigned long frameDirty;    //Cells not sent to the LCD yet (bit i : cell i)
+byte lcdCursor;              //Cell where LCD writes next
+
+//Writes a character in a frame cell, flagged if changed
+void DisplayPut(byte i, byte c)
+{
+  if (aFrame[i] == c)
+    return;
+  aFrame[i] = c;
+  frameDirty |= 1UL << i;
+}
+
 void DisplaySetup()
 {
   //Setup LCD
-  lcd.begin(16, 2);
-  lcd.home();
+  lcd.begin(DISPLAY_COLS, DISPLAY_LINES);
+  lcd.clear();
+  memset(aFrame, ' ', DISPLAY_CELLS);
+  frameDirty = 0;
+  lcdCursor = DISPLAY_NOWHERE;
   
   //Setup LEDs
   pinMode(GREEN_PIN, OUTPUT);
@@ -40,6 +66,26 @@ void DisplayUpdate()
     greenTime = 0; 
     digitalWrite(GREEN_PIN, HIGH);  
   }
+
+  DisplaySend(DISPLAY_FLUSH);
+}
+
+//Sends up to count changed cells to the LCD
+void DisplaySend(byte count)
+{
+  byte i;
+
+  for (i = 0; (i < DISPLAY_CELLS) && count && frameDirty; i++)
+  {
+    if (!(frameDirty & (1UL << i)))
+      continue;
+    if (lcdCursor != i) //Consecutive cells need no cursor move
+      lcd.setCursor(i % DISPLAY_COLS, i / DISPLAY_COLS);
+    lcd.write(aFrame[i]);
+    frameDirty &= ~(1UL << i);
+    lcdCursor = ((i + 1) % DISPLAY_COLS) ? i + 1 : DISPLAY_NOWHERE; //No wrap to next line
+    count --;
+  }
 }
 
 void DisplayBlinkRed()
@@ -54,36 +100,65 @@ void DisplayBlinkGreen()
   digitalWrite(GREEN_PIN, LOW);  
 }
 
+//Sends whole frame now (blocking : setup and debug only)
+void DisplayFlush()
+{
+  DisplaySend(DISPLAY_CELLS);
+}
+
 void DisplayClear()
 {
-  lcd.clear();
+  byte i;
+
+  for (i = 0; i < DISPLAY_CELLS; i++)
+    DisplayPut(i, ' ');
 }
 
 void DisplayWriteStr(const char * str, byte line, byte col)
 {
-  lcd.home();
-  //lcd.setCursor(line, col); //Row / col
-  lcd.setCursor(col, line); //Row / col
-  lcd.print(str);
+  byte i = line*DISPLAY_COLS + col;
+
+  while (*str && (col++ < DISPLAY_COLS)) //Clipped at end of line
+    DisplayPut(i++, *str++);
+}
+
+void DisplayWriteStr(const __FlashStringHelper * str, byte line, byte col)
+{
+  const char * f = (const char *)str;
+  byte i = line*DISPLAY_COLS + col;
+  char c;
+
+  while ((c = pgm_read_byte(f++)) && (col++ < DISPLAY_COLS))
+    DisplayPut(i++, c);
 }
 
 void DisplayWriteInt(int  val, byte line, byte col)
 {
-  lcd.home();
-  //lcd.setCursor(line, col); //Row / col
-  lcd.setCursor(col, line); //Row / col
-  lcd.print(val);
+  char str[7];
+  itoa(val, str, 10);
+  DisplayWriteStr(str, line, col);
+}
+
+void DisplayWriteLong(long val, byte line, byte col)
+{
+  char str[12];
+  ltoa(val, str, 10);
+  DisplayWriteStr(str, line, col);
 }
 
 
-void DisplayCreateChar(byte array[8], byte id)
+void DisplayCreateChar(const byte * array, byte id)
 {
-  lcd.createChar(id, array);
+  byte rows[8];
+  byte i;
+
+  for (i = 0; i < 8; i++)
+    rows[i] = pgm_read_byte(&array[i]);
+  lcd.createChar(id, rows);
+  lcdCursor = DISPLAY_NOWHERE; //LCD now addresses characters memory
 }
 
 void DisplayWriteChar(byte id, byte line, byte col)
 {
-  lcd.home();
-  lcd.setCursor(col, line); //Row / col
-  lcd.write(id);
+  DisplayPut(line*DISPLAY_COLS + col, id);
 }
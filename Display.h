@@ -1,14 +1,17 @@
 #include "Arduino.h"
 void DisplaySetup();
-void DisplayUpdate();
+void DisplayUpdate(); //Sends a few changed cells to the LCD
+void DisplayFlush();  //Sends all changed cells now (blocking)
 
 
 void DisplayBlinkRed();
 void DisplayBlinkGreen();
 
-void DisplayCreateChar(byte array[8], byte id);
+void DisplayCreateChar(const byte * array, byte id); //array : 8 rows, in flash (PROGMEM)
 void DisplayWriteChar(byte id, byte line, byte col);
 
 void DisplayWriteStr(const char * str, byte line, byte col);
+void DisplayWriteStr(const __FlashStringHelper * str, byte line, byte col); //F("...")
 void DisplayWriteInt(int val,          byte line, byte col);
+void DisplayWriteLong(long val,        byte line, byte col);
 void DisplayClear();
@@ -1,13 +1,16 @@
 #include "MIDIProcessor.h"
 #include "Controls.h"
 #include "Display.h"
+#include "Looper.h"
+#include "Tasks.h"
+#include "Profile.h"
 
 
 #define _DEBUG
 #define IS_NOTE_OFF(_n)    (((((_n).velocity&0x7F) == 0x00)?true  : false))
 
 
-byte CharPlay[8] = {
+const byte CharPlay[8] PROGMEM = {
   0b00000,
   0b10000,
   0b11000,
@@ -18,7 +21,7 @@ byte CharPlay[8] = {
   0b00000,
 };
 
-byte CharStop[8] = {
+const byte CharStop[8] PROGMEM = {
   0b00000,
   0b10010,
   0b10010,
@@ -43,38 +46,115 @@ typedef enum
   eLooperRecording  //Record notes and detect loops
 } tLooperStatus;
 
-typedef struct //8 byte struct
-{
-  unsigned int time;
-  byte note;
-  byte velocity;
-  unsigned int duration;
-} tNoteEvent;
-
-
-#define MAX_SAMPLE 32 //Max events in sample (32 notes)
-#define MAX_SLOTS 4
 byte slotIdx = 0;
 
 typedef struct
 {
-  tNoteEvent aNoteEvents[MAX_SAMPLE];
-  
   byte noteIdx;  //Current note record index
   byte sampleSize;  //Complete size of sample 
-  unsigned int repeatDelay; //delay between last not and first note
+  unsigned int repeatDelay; //delay between last not and first note (ticks)
   
   byte replayIdx;              //Current note being played on the loop
-  unsigned long previousLoopTimestamp;  //Ts of last played NoteOff (Note Off are not ordered, so we have no index) 
+  byte replayNote;             //Note replayIdx, decoded from store (its time is replayCursor.time)
+  byte replayVelocity;
+  byte replayDuration;         //Encoded, see DurationEncode
+  tStoreCursor replayCursor;   //Store position of the note after replayIdx
   unsigned long  firstNoteTimestamp;  //Current timestamp for note 0 when playing or recording "when did we play first note ?"
   byte bChannel;               //MIDI channel for this slot
-  tLooperStatus slotStatus;    //Slot status
+  byte slotStatus;             //Slot status (tLooperStatus)
 } tLooperSlot;
 
 tLooperMode   looperMode;
 tLooperStatus looperStatus;
 tLooperSlot   aSlots[MAX_SLOTS];
 unsigned long displayTimeout;
+const __FlashStringHelper * displayMsg; //Message to draw (flash), NULL if none
+
+//Loop detection state : recorded notes grouped by onsets (chords), see LoopDetect
+//Onsets are only needed while recording : they are kept in store blocks lent by StoreTake (5 per block),
+//so that the table uses free events memory, and given back once the loop is found or recording restarts
+//Only one slot records at a time (see slotRecordCb) : the table always belongs to it, it is never rebuilt
+#define ONSET_BLOCKS    13 //Max blocks for onsets : 65 onsets (a loop must be recorded twice)
+#define ONSET_WINDOW    30 //Notes played within this delay (ticks) belong to the same onset (chord)
+#define ONSET_CHORD     0x80 //Signature of a chord (single notes : note itself)
+#define IOI_TOLERANCE   4  //Allowed timing difference between repetitions (1/4 of inter-onset interval)
+#define LOOP_MIN_ONSETS 3  //Shorter loops are taken several times : "A B A B A C" is not looped on "A B"
+
+typedef struct
+{
+  byte ioi;           //Inter-onset interval : delay since previous onset (encoded as a duration, see DurationEncode)
+  byte sig;           //Notes signature, whatever their order : note itself for a single note, ONSET_CHORD | sum of hashes for a chord
+  byte prefix;        //Prefix function : longest proper prefix of onsets 0..i which is also a suffix
+} tOnset;
+
+#define ONSETS_PER_BLOCK (STORE_BLOCK / sizeof(tOnset))
+
+byte         aOnsetBlocks[ONSET_BLOCKS]; //Store blocks holding the onsets
+byte         onsetCount;  //Onsets found so far
+byte         onsetSlot;   //Slot being recorded
+byte         onsetSpan;   //Onsets of the loop found (0 : none yet), sample size and repeat delay are read for it
+unsigned int onsetTime;   //Start of last onset (ticks since loop start, 16 bits are enough for intervals)
+
+//Recorded notes waiting for their NoteOff
+#define MAX_OPEN 8
+
+typedef struct
+{
+  byte         note;
+  unsigned int handle; //Store handle, to set duration
+  unsigned int time;   //NoteOn time (ticks since loop start)
+} tOpenNote;
+
+tOpenNote aOpenNotes[MAX_OPEN];
+byte      openCount;
+
+//Overdub : notes played on a playing slot are merged into its loop, once their NoteOff is received
+#define MAX_DUB  4
+#define DUB_NONE 0xFF
+
+typedef struct
+{
+  byte          note;
+  byte          velocity;
+  unsigned long time;      //NoteOn position in loop (ticks)
+  unsigned int  timestamp; //NoteOn time (16 bits are enough for durations)
+} tDubNote;
+
+byte     dubSlot = DUB_NONE; //Slot being overdubbed
+tDubNote aDubNotes[MAX_DUB];
+byte     dubCount;
+
+//Shared transport : first loop played is the master, loops accepted later are snapped to it
+//(length : multiple or divisor of master loop, start : on a master loop start or division)
+#define MASTER_NONE   0xFF
+#define MASTER_RATIOS 8  //Loops last from 1/8 to 8 master loops
+byte masterSlot = MASTER_NONE;
+
+//Record-time quantization : notes are moved towards a grid (ticks since loop start, integer math only)
+//Notes quantized to the same tick share their time : they are played as one burst
+//Knob 2 sets the grid, the strength or the swing : a double press on button 3 selects which one (quantEdit)
+#define QUANT_GRIDS     7  //Grids : off, 1/4, 1/8, 1/8T, 1/16, 1/16T, 1/32
+#define QUANT_STRENGTHS 4  //Strengths : move towards grid (1/16) : 16 = on grid, 8 = half way
+#define QUANT_SWINGS    5  //Swings : delay of off-beat grid steps (1/16 of a step) : 0 = straight, 5 = triplet feel
+const byte aQuantGrids[QUANT_GRIDS] PROGMEM = {0, 4, 8, 12, 16, 24, 32}; //Steps per whole note (0 : off)
+const char aQuantNames[QUANT_GRIDS][8] PROGMEM = {"Q Off", "Q 1/4", "Q 1/8", "Q 1/8T", "Q 1/16", "Q 1/16T", "Q 1/32"}; //Triplets : 3 steps per 2 straight ones
+const byte aQuantStrengths[QUANT_STRENGTHS] PROGMEM = {16, 12, 8, 4};
+const char aStrengthNames[QUANT_STRENGTHS][8] PROGMEM = {"Q 100%", "Q 75%", "Q 50%", "Q 25%"};
+const byte aQuantSwings[QUANT_SWINGS] PROGMEM = {0, 2, 4, 5, 8};
+const char aSwingNames[QUANT_SWINGS][8] PROGMEM = {"Sw Off", "Sw 12%", "Sw 25%", "Sw 3T", "Sw 50%"};
+
+typedef enum
+{
+  eQuantEditGrid = 0,
+  eQuantEditStrength,
+  eQuantEditSwing,
+  eQuantEditCount
+} tQuantEdit;
+
+byte quantGrid;      //Selected grid (index)
+byte quantStrength;  //Selected strength (index, 0 : on grid)
+byte quantSwing;     //Selected swing (index, 0 : straight)
+byte quantEdit;      //Setting of knob 2 (tQuantEdit)
 
 //Callbacks for buttons/Knobs
 void changeLooperModeCb(byte button, tButtonStatus event, int duration); //Auto/Manual
@@ -82,18 +162,58 @@ void slotPlayMuteCb(byte button, tButtonStatus event, int duration); //Start/sto
 void slotRecordCb(byte button, tButtonStatus event, int duration); //Start Recording
 void generalPlayStopCb(byte button, tButtonStatus event, int duration); //RePlay previous loop on current slot
 void dumpLoopCb(byte button, tButtonStatus event, int duration); //Dump loop contents
+void saveSlotsCb(byte button, tButtonStatus event, int duration); //Save slots in EEPROM
 void slotSelectCb (byte knob, int value, tKnobRotate rot);
+void debugPageCb (byte knob, int value, tKnobRotate rot); //Inspector paging
+void quantEditCb(byte button, tButtonStatus event, int duration); //Quantization setting of knob 2
+void quantKnobCb (byte knob, int value, tKnobRotate rot); //Quantization grid, strength or swing
+byte KnobLevel(int value, byte levels);
 
-//MIDI event callback
+//MIDI event callbacks
 byte NoteCb(byte channel, byte note, byte velocity, unsigned long timestamp);
+void ClockCb(tMIDIClockEvent event);
 
 //Looper mode changes
 void SetGlobalMode(tLooperMode mode);
 void SetStatus(tLooperStatus lstatus);
 void ResetLoop(byte slot);
-void ResetPlay(byte playIdx = 0);
-
-void RefreshDisplay(const char * msg = NULL);
+void ResetPlay(byte slot, byte playIdx, unsigned long timestamp);
+void ReplayNext(byte slot);
+void ScheduleNote(byte slot);
+void ChannelAllOff(byte channel);
+void DubNote(byte note, byte velocity, unsigned long timestamp);
+void DubStop(unsigned long timestamp);
+unsigned long LoopLength(byte slot);
+void MasterJoin(byte slot, boolean snap);
+
+void RefreshDisplay(const __FlashStringHelper * msg = NULL);
+void DrawDisplay();
+void DrawPosition(unsigned long timestamp);
+#define POSITION_CELLS 10 //Loop position bar, line 2 (hidden by messages)
+
+//Debug inspector : slot info pages, MIDI input and output pages, timing pages (one per profiling zone), task overruns page,
+//then one page per event
+//Shown from LooperUI, looping and passthrough keep on running
+#define DEBUG_CLOSED     0xFFFF
+#define DEBUG_SLOT_PAGES 4
+#define DEBUG_INFO_PAGES (DEBUG_SLOT_PAGES + eProfileCount + 1)
+#define DEBUG_PAGE_MS    1500  //Auto paging delay
+unsigned int  debugPage = DEBUG_CLOSED;  //Shown page
+unsigned int  debugDrawn;                //Page drawn on screen
+byte          debugChanges;              //slotsChanges when page was drawn
+boolean       debugAuto;                 //Auto paging, until knob 2 is moved
+unsigned long debugTime;                 //Last page change
+void DebugUpdate();
+void DebugClose();
+void DebugProfile(byte zone);
+void DebugTasks();
+const char aProfileNames[eProfileCount][5] PROGMEM = {"MIDI", "Loop", "Ctrl", "LCD", "Late"};
+
+//Slots persistence
+#define SLOT_IMAGE_HEADER 6 //Per slot : channel, sample size, repeat delay (2), events length (2)
+void LoadSlots();
+byte slotsChanges; //Incremented each time a loop is added or removed
+byte saveChanges;  //slotsChanges when save started
 
 
 
@@ -101,25 +221,44 @@ void LooperSetup()
 {
   int i;
   MIDIRegisterNoteCb(NoteCb);
+  MIDIRegisterClockCb(ClockCb);
 
   DisplayCreateChar(CharPlay, 0);
   DisplayCreateChar(CharStop, 1);
 
+  QueueReset();
+  StoreSetup();
+  onsetSlot  = 0;
+  onsetCount = 0;
+  openCount  = 0;
   memset(aSlots, 0x00, MAX_SLOTS*sizeof(tLooperSlot));
   for (i = 0; i < MAX_SLOTS; i++)
     ResetLoop(i);
+  LoadSlots(); //Restore slots saved in EEPROM
+  SMFSetup();  //Slots transfers over SysEx
 
   ControlsRegisterButtonCallback(0, eButtonStatus_Released, 0, changeLooperModeCb); //Auto / Manual
+  ControlsRegisterButtonCallback(0, eButtonStatus_Double, 0, quantEditCb); //Quantization setting of knob 2
 #ifdef _DEBUG
-  ControlsRegisterButtonCallback(0, eButtonStatus_Released, 1000, dumpLoopCb); //Debug : Dump notes
+  ControlsRegisterButtonCallback(0, eButtonStatus_Long, 1000, dumpLoopCb); //Debug : Dump notes
 #endif
   ControlsRegisterButtonCallback(1, eButtonStatus_Released, 0, slotPlayMuteCb); //Play / Idle
-  ControlsRegisterButtonCallback(1, eButtonStatus_Released, 1000, slotRecordCb); //Record 
+  ControlsRegisterButtonCallback(1, eButtonStatus_Long, 1000, slotRecordCb); //Record (while held : recording starts after 1s)
 
   ControlsRegisterButtonCallback(2, eButtonStatus_Released, 0, generalPlayStopCb); //RePlay previous loop on current slot
+  ControlsRegisterButtonCallback(2, eButtonStatus_Long, 1000, saveSlotsCb); //Save slots
 
   ControlsRegisterKnobCallback(0, slotSelectCb); //Select slot for loop
+  //Knob 2 is modal : inspector paging while the inspector is shown, else quantization (each callback returns in the other mode)
+#ifdef _DEBUG
+  ControlsRegisterKnobCallback(1, debugPageCb); //Debug : inspector paging
+#endif
+  ControlsRegisterKnobCallback(1, quantKnobCb); //Quantization grid, strength or swing
   ControlsNotifyKnob(0); //Force update for init
+  quantGrid = KnobLevel(ControlsKnobValue(1), QUANT_GRIDS); //Silently : no message over the startup screen
+  quantStrength = 0;
+  quantSwing    = 0;
+  quantEdit     = eQuantEditGrid;
   
 
   SetGlobalMode(eLooperAuto);
@@ -130,125 +269,348 @@ void LooperSetup()
 
 void LooperUpdate()
 {
-  byte s, i;
-  
-  if (looperStatus != eLooperPlaying) //Nothing to do
-    return;
-  unsigned long timestamp = millis();
+  tPendingEvent ev;
+  unsigned long timestamp = MIDIClockNow();
   
-  // Play recorded loops
-  for (s = 0; s < MAX_SLOTS; s++)
+  // Play due events of recorded loops
+  // Muted slots (and all slots when looper is idle) keep on running silently to keep sync
+  while (QueuePop(timestamp, &ev))
   {
-    tLooperSlot * slot = &aSlots[s];
+    tLooperSlot * slot;
+    byte s;
+
+    //Release note
+    if ((ev.status & 0xF0) == 0x80)
+    {
+      MIDISend(eMIDIOutUrgent, 3, ev.status, ev.note, MIDI_RELEASE_DEFAULT);
+      ProfileLate(timestamp - ev.due);
+      continue;
+    }
     
-    if (slot->sampleSize && ((slot->slotStatus == eLooperPlaying)||(slot->slotStatus == eLooperIdle)))
+    //Play note
+    s    = ev.note; //NoteOn entries hold their slot
+    slot = &aSlots[s];
+    if ((looperStatus == eLooperPlaying) && (slot->slotStatus == eLooperPlaying))
     {
-      //A (0ms)  B (10ms) C (5ms) D (1ms) E (100ms) A (0ms) ...
-      //Increase timers ont muted slots to keep sync
+      MIDISend(eMIDIOutNormal, 3, 0x90 | slot->bChannel, slot->replayNote, slot->replayVelocity);
+      ProfileLate(timestamp - ev.due);
       
-      //Play note ON events
-      while ((timestamp > slot->firstNoteTimestamp) && //firstNoteTimestampcan be set to a future date (end loop delay)
-             ((int)(timestamp - slot->firstNoteTimestamp) >= slot->aNoteEvents[slot->replayIdx].time))
+      //Release velocity is not recorded : default one (sent with running status)
+      if (!QueuePush(ev.due + DurationDecode(slot->replayDuration), 0x80 | slot->bChannel, slot->replayNote))
       {
-         //On first loop note, make sure there's no pending Note Off to be processed from previous loop
-        if (!slot->replayIdx) 
-        {
-          //Flush remaning note off
-          for (i = 0; i < slot->sampleSize; i++)
-          {
-            unsigned int noteOffTs = slot->aNoteEvents[i].time + slot->aNoteEvents[i].duration;
-            if (slot->previousLoopTimestamp < timestamp + noteOffTs)
-            {
-              Serial.write(0x80 | slot->bChannel);
-              Serial.write(slot->aNoteEvents[i].note);
-              Serial.write(slot->aNoteEvents[i].velocity);
-            }
-          }
-          slot->previousLoopTimestamp = slot->firstNoteTimestamp;
-        }
-        
-        //Play note
-        if (slot->slotStatus == eLooperPlaying)
-        {
-          Serial.write(0x90 | slot->bChannel);
-          Serial.write(slot->aNoteEvents[slot->replayIdx].note);
-          Serial.write(slot->aNoteEvents[slot->replayIdx].velocity);
-        }
-        slot->replayIdx ++;
-          
-        //End of loop, start again
-        if (slot->replayIdx == slot->sampleSize) 
-        {
-          //Start at idx 0
-          slot->replayIdx = 0;
-          
-          //Wait for last note to end using repeatDelay (we don't want to play last note and first one at the same time !)
-          slot->firstNoteTimestamp = millis() + slot->repeatDelay; //Set sequence ts start
-        }
+        //No room left to schedule its release, play it short rather than stuck
+        MIDISend(eMIDIOutUrgent, 3, 0x80 | slot->bChannel, slot->replayNote, MIDI_RELEASE_DEFAULT);
       }
+    }
+    slot->replayIdx ++;
       
-      //Play note off events
-      for (i = 0; i < slot->sampleSize; i++)
-      {
-        unsigned int noteOffTs = slot->aNoteEvents[i].time + slot->aNoteEvents[i].duration;
-        if ((slot->previousLoopTimestamp < slot->firstNoteTimestamp + noteOffTs) && //not already played
-            (timestamp >= slot->firstNoteTimestamp + noteOffTs))                     //time to play it
-        {
-          Serial.write(0x80 | slot->bChannel);
-          Serial.write(slot->aNoteEvents[i].note);
-          Serial.write(slot->aNoteEvents[i].velocity);
-        }
-      }
-      slot->previousLoopTimestamp = timestamp;
+    //End of loop, start again
+    if (slot->replayIdx == slot->sampleSize) 
+    {
+      //Start at idx 0
+      slot->replayIdx = 0;
+      
+      //Wait for last note to end using repeatDelay (we don't want to play last note and first one at the same time !)
+      //Next round starts exactly one loop length later, whenever this wrap is processed : no drift between slots
+      slot->firstNoteTimestamp += slot->replayCursor.time + slot->repeatDelay; //Set sequence ts start
+
+      StoreRewind(&slot->replayCursor);
     }
+    ReplayNext(s);
+    ScheduleNote(s);
   }
   
+}
+
+//Time left before next due event (us)
+unsigned long LooperSlack()
+{
+  unsigned long due;
+  long ticks;
+
+  if (!QueueNext(&due))
+    return 0xFFFFFFFF;
+  ticks = due - MIDIClockNow();
+  if (ticks <= 0)
+    return 0;
+  if (ticks > 1000) //Far enough, avoid overflow
+    ticks = 1000;
+  return ticks * (MIDIClockTempo() / CLOCK_PPQN);
+}
+
+void LooperBackground()
+{
+  //Slot dump over SysEx (a few bytes per call)
+  SMFUpdate();
+
+  //Background save
+  if (SaveBusy())
+  {
+    if (slotsChanges != saveChanges) //Slots changed while saving : start over
+      saveSlotsCb(0, eButtonStatus_Released, 0);
+    else if (SaveUpdate())
+      RefreshDisplay(F("Saved"));
+  }
+}
+
+void LooperUI()
+{
   //Auto vanish messages after 2s
-  if (displayTimeout && ((int)(timestamp - displayTimeout) > 2000))
+  if (displayTimeout && ((int)(millis() - displayTimeout) > 2000))
     RefreshDisplay();
+  if (debugPage != DEBUG_CLOSED)
+  {
+    DebugUpdate();
+    return;
+  }
+  DrawPosition(MIDIClockNow());
 }
 
-//Updates "sampleSIze" to the longest loop found on given slot
-//Returns current position in loop in that case or 0xFF if no loop is detected
-byte LoopDetect(tLooperSlot * slot)
+//Order independent hash of chord notes
+byte NoteHash(byte note)
 {
-  if (slot->noteIdx < 4) //Need at least 4 notes "AB AB" to detect "AB".
-    return 0xFF;
-  
-  if ((slot->aNoteEvents[0].note == slot->aNoteEvents[slot->noteIdx - 2].note) &&
-      (slot->aNoteEvents[1].note == slot->aNoteEvents[slot->noteIdx - 1].note))
+  return (note * 0x9D) ^ (note >> 3);
+}
+
+//Onset i, in its store block
+tOnset * Onset(byte i)
+{
+  return (tOnset *)StoreBlock(aOnsetBlocks[i / ONSETS_PER_BLOCK]) + (i % ONSETS_PER_BLOCK);
+}
+
+//Gives back the onsets blocks
+void OnsetReset()
+{
+  byte i;
+
+  for (i = 0; i < (onsetCount + ONSETS_PER_BLOCK - 1) / ONSETS_PER_BLOCK; i++)
+    StoreGive(aOnsetBlocks[i]);
+  onsetCount = 0;
+  onsetSpan  = 0;
+}
+
+//Do onsets a and b have same notes (in any order) and same delay since previous onset ?
+//Onset 0 has no previous onset : only notes are compared
+bool OnsetMatch(byte a, byte b)
+{
+  tOnset * oa = Onset(a);
+  tOnset * ob = Onset(b);
+
+  if (oa->sig != ob->sig)
+    return false;
+
+  if (a && b)
+  {
+    unsigned int ioiA = DurationDecode(oa->ioi);
+    unsigned int ioiB = DurationDecode(ob->ioi);
+    unsigned int diff = (ioiA > ioiB) ? (ioiA - ioiB) : (ioiB - ioiA);
+    unsigned int tolerance = ioiB / IOI_TOLERANCE;
+
+    if (tolerance < ONSET_WINDOW)
+      tolerance = ONSET_WINDOW;
+    if (diff > tolerance)
+      return false;
+  }
+  return true;
+}
+
+//Updates prefix function of last onset (called again each time a chord gets a new note)
+void OnsetPrefix()
+{
+  byte i = onsetCount - 1;
+  byte k;
+
+  if (!i)
+  {
+    Onset(0)->prefix = 0;
+    return;
+  }
+  k = Onset(i - 1)->prefix;
+  while (k && !OnsetMatch(i, k))
+    k = Onset(k - 1)->prefix;
+  if (OnsetMatch(i, k))
+    k ++;
+  Onset(i)->prefix = k;
+}
+
+//Groups a recorded note into onsets (returns false if too many onsets, or store full)
+bool OnsetAdd(byte note, unsigned long time)
+{
+  tOnset * last = onsetCount ? Onset(onsetCount - 1) : NULL;
+
+  if (last && ((unsigned int)time - onsetTime <= ONSET_WINDOW)) //Chord
+    last->sig = ONSET_CHORD | (((last->sig & ONSET_CHORD) ? last->sig : NoteHash(last->sig)) + NoteHash(note));
+  else
+  {
+    if (!(onsetCount % ONSETS_PER_BLOCK)) //Block full
+    {
+      byte blk;
+
+      if (onsetCount == ONSET_BLOCKS*ONSETS_PER_BLOCK)
+        return false;
+      blk = StoreTake();
+      if (blk == STORE_NONE)
+        return false;
+      aOnsetBlocks[onsetCount / ONSETS_PER_BLOCK] = blk;
+    }
+    last = Onset(onsetCount++);
+    last->ioi   = (onsetCount > 1) ? DurationEncode((unsigned int)time - onsetTime) : 0;
+    last->sig   = note;
+    onsetTime   = time;
+  }
+  OnsetPrefix();
+  return true;
+}
+
+//Reads onsets of slot s from the store (same grouping as OnsetAdd), up to the first note of given onset
+//Returns the number of notes before it, sets its time and the time of the note before it
+//Called once per loop found : detection itself never reads the store
+byte OnsetNotes(byte s, byte onset, unsigned long * time, unsigned long * prev)
+{
+  tStoreCursor cur;
+  tNoteEvent   ev;
+  unsigned int start = 0;
+  byte notes = 0, i = 0;
+
+  *time = 0;
+  *prev = 0;
+  StoreRewind(&cur);
+  while (StoreNext(s, &cur, &ev))
+  {
+    if (!notes || ((unsigned int)ev.time - start > ONSET_WINDOW)) //Next onset
+    {
+      if (i++ == onset)
+      {
+        *time = ev.time;
+        break;
+      }
+      start = ev.time;
+    }
+    *prev = ev.time;
+    notes ++;
+  }
+  return notes;
+}
+
+//Looks for the shortest period of the onsets recorded on given slot
+//Notes played within ONSET_WINDOW are one onset : chords match whatever the notes order
+//A loop is accepted once it has been fully repeated ("A B C A B D" needs "A B C A B D A B C A B D")
+//Loops of less than LOOP_MIN_ONSETS onsets are taken as many times as needed ("A B" : "A B A B" played twice),
+//so that a phrase starting with a repeated motif ("A B A B A C") is not looped on that motif
+//Incremental : onsets and prefix function are updated by AddNoteOn (amortized O(1) per note), the store is
+//only read when a new loop is found, to set "sampleSize" and "repeatDelay"
+//Returns true if a loop is found : its first onsetSpan onsets are the sample
+boolean LoopDetect(byte s)
+{
+  tLooperSlot * slot = &aSlots[s];
+  byte n = onsetCount;
+  byte period, span;
+  unsigned long time, prev;
+
+  if (!n)
+    return false;
+  period = n - Onset(n - 1)->prefix;
+  for (span = period; span < LOOP_MIN_ONSETS; span += period)
+    ;
+  if (n < 2*span) //Loop not repeated yet
+    return false;
+
+  if (span != onsetSpan) //New loop : sample length (notes of the first "span" onsets) and delay between its last and first notes
   {
-    //Set sample length
-    slot->sampleSize = slot->noteIdx - 2;
-    //Compute delay between last note of the sample and first one
-    //If we don't do last, first note will be play immediately after last one
-    slot->repeatDelay = slot->aNoteEvents[slot->noteIdx-2].time - slot->aNoteEvents[slot->noteIdx-3].time;
-    return 1;//Consider we've been playing note 1 (0, 1 .. and then next is 2)
+    onsetSpan = span;
+    slot->sampleSize  = OnsetNotes(s, span, &time, &prev);
+    slot->repeatDelay = time - prev; //If we don't do last, first note will be play immediately after last one
   }
-  return 0xFF; //Nothing found
+  return true;
+}
+
+//Quantized time (ticks since loop start)
+//Grid steps go by pairs from loop start, the second step of each pair is delayed by swing
+unsigned long QuantTime(unsigned long t)
+{
+  unsigned int step, pair, off, pos;
+  unsigned long q;
+  byte strength;
+
+  if (!pgm_read_byte(&aQuantGrids[quantGrid]))
+    return t;
+  step = 4*CLOCK_PPQN / pgm_read_byte(&aQuantGrids[quantGrid]);
+  pair = step << 1;
+  off  = step + ((step * pgm_read_byte(&aQuantSwings[quantSwing])) >> 4);
+  pos  = t % pair;
+
+  //Nearest grid point
+  q = t - pos;
+  if (pos >= (pair + off) >> 1)
+    q += pair;
+  else if (pos >= off >> 1)
+    q += off;
+
+  //Move towards it (never changes events order)
+  strength = pgm_read_byte(&aQuantStrengths[quantStrength]);
+  return (t * (16 - strength) + q * strength) >> 4;
+}
+
+//Quantized duration of a note : its end is quantized too, unless the note would vanish
+unsigned long QuantDuration(unsigned long start, unsigned long end)
+{
+  unsigned long qStart = QuantTime(start);
+  unsigned long qEnd   = QuantTime(end);
+
+  return (qEnd > qStart) ? qEnd - qStart : end - start;
 }
 
-bool AddNoteOff(tLooperSlot * slot, byte note, unsigned long timestamp)
+bool AddNoteOff(byte s, byte note, unsigned long timestamp)
 {
+  tLooperSlot * slot = &aSlots[s];
+  unsigned long end = timestamp - slot->firstNoteTimestamp;
+  int i;
+
   //Note off : try to find correponding Note On and update duration
-  for (int i = slot->noteIdx - 1; i >= 0; i--)
+  for (i = openCount - 1; i >= 0; i--)
   {
-    if ((slot->aNoteEvents[i].note == note) && (slot->aNoteEvents[i].duration == 0)) //Corresponding Note On found !
+    if (aOpenNotes[i].note == note) //Corresponding Note On found !
     {
-      //Update note duration
-      slot->aNoteEvents[i].duration = (int)(timestamp - slot->firstNoteTimestamp) - slot->aNoteEvents[i].time;
+      //Update note duration (NoteOn time is kept on 16 bits)
+      StoreSetDuration(s, aOpenNotes[i].handle, QuantDuration(end - (unsigned int)((unsigned int)end - aOpenNotes[i].time), end));
+      openCount --;
+      memmove(&aOpenNotes[i], &aOpenNotes[i+1], (openCount - i)*sizeof(tOpenNote));
       return true;
     }
   }
   return false; 
 }
 
-bool AddNoteOn(tLooperSlot * slot, byte note, byte velocity, unsigned long timestamp)
+bool AddNoteOn(byte s, byte note, byte velocity, unsigned long timestamp)
 {
-  slot->aNoteEvents[slot->noteIdx].note     = note;
-  slot->aNoteEvents[slot->noteIdx].time     = (int)(timestamp - slot->firstNoteTimestamp);
-  slot->aNoteEvents[slot->noteIdx].velocity = velocity;
-  slot->aNoteEvents[slot->noteIdx].duration = 0;  //Note Off event will set duration
+  tLooperSlot * slot = &aSlots[s];
+  tNoteEvent ev;
+  unsigned int handle;
+
+  if (slot->noteIdx == 0xFF)
+    return false;
+
+  ev.note     = note;
+  ev.time     = QuantTime(timestamp - slot->firstNoteTimestamp);
+  ev.velocity = velocity;
+  ev.duration = 0;  //Note Off event will set duration
+
+  if (!OnsetAdd(note, ev.time))
+    return false;
+  handle = StoreAppend(s, &ev);
+  if (handle == STORE_FULL)
+    return false;
+
+  if (openCount == MAX_OPEN) //Forget oldest note (remains a short note)
+  {
+    openCount --;
+    memmove(&aOpenNotes[0], &aOpenNotes[1], openCount*sizeof(tOpenNote));
+  }
+  aOpenNotes[openCount].note   = note;
+  aOpenNotes[openCount].handle = handle;
+  aOpenNotes[openCount].time   = timestamp - slot->firstNoteTimestamp; //Not quantized, see QuantDuration
+  openCount ++;
+
   slot->noteIdx ++;  
   return true;
 }
@@ -256,11 +618,10 @@ bool AddNoteOn(tLooperSlot * slot, byte note, byte velocity, unsigned long times
 //Adds a note on the current slot
 //Detects and optimize chords
 //returns false on slot full
-bool AddNote(tLooperSlot * slot, byte note, byte velocity, byte channel, unsigned long timestamp)
+bool AddNote(byte s, byte note, byte velocity, byte channel, unsigned long timestamp)
 {
-  if (slot->noteIdx == MAX_SAMPLE) //Slot full
-    return false;
-   
+  tLooperSlot * slot = &aSlots[s];
+
   if ((slot->noteIdx == 0) && (velocity == 0))//Ignore "NoteOff" as first sample event (not an error)
     return true;
     
@@ -272,9 +633,9 @@ bool AddNote(tLooperSlot * slot, byte note, byte velocity, byte channel, unsigne
   }
   
   if (!velocity)  
-    return AddNoteOff(slot, note, timestamp);
+    return AddNoteOff(s, note, timestamp);
   else
-    return AddNoteOn(slot, note, velocity, timestamp);
+    return AddNoteOn(s, note, velocity, timestamp);
   
   return true;
 }
@@ -284,7 +645,6 @@ bool AddNote(tLooperSlot * slot, byte note, byte velocity, byte channel, unsigne
 //Return : Silent ?
 byte NoteCb(byte channel, byte note, byte velocity, unsigned long timestamp)
 {
-  byte loopFound;
   tLooperSlot * slot = &aSlots[slotIdx];
   DisplayBlinkRed();
 
@@ -292,27 +652,23 @@ byte NoteCb(byte channel, byte note, byte velocity, unsigned long timestamp)
     return false;
 
   if (slot->slotStatus == eLooperPlaying) //Simply replay received note FIXME : stop passthrough when just starting replay ?
-    return false;
-    
-  //Recording
-  if (slot->noteIdx == MAX_SAMPLE) //Pattern too long
   {
-    slot->slotStatus = eLooperIdle;
-    RefreshDisplay((char*)"Too long !");
-    ResetLoop(slotIdx);
+    if (dubSlot == slotIdx)
+      DubNote(note, velocity, timestamp);
     return false;
   }
-  
+    
+  //Recording
   if (!velocity && !slot->noteIdx) //Loop may not start with a NoteOff event ...
     return false;
    
   //DisplayBlinkGreen();
-  if (!AddNote(slot, note, velocity, channel, timestamp))
+  if (!AddNote(slotIdx, note, velocity, channel, timestamp))
   {
     //Cannot add another note on slot
     //-> sample must be too long
     slot->slotStatus = eLooperIdle;
-    RefreshDisplay((char*)"Too long !");
+    RefreshDisplay(F("Too long !"));
     ResetLoop(slotIdx);
     return false;
   }
@@ -320,22 +676,35 @@ byte NoteCb(byte channel, byte note, byte velocity, unsigned long timestamp)
   if ((velocity & 0x7F) == 0x00) //NoteOff is not used to setup a loop
     return false;
   
-  loopFound = LoopDetect(slot);
- 
-  if (loopFound == 0xFF)//No loop, continue
+  if (!LoopDetect(slotIdx))//No loop, continue
     return false;
    
   if (looperMode   == eLooperAuto)
   {
+    //Go on with next note (phase : next onset of the loop), keeping the tempo of the note just played
+    unsigned long time, prev;
+    unsigned int wait = slot->repeatDelay;
+    byte next = 0;
+
+    if (onsetCount % onsetSpan)
+    {
+      next = OnsetNotes(slotIdx, onsetCount % onsetSpan, &time, &prev);
+      wait = time - prev;
+    }
+
+    StoreTruncate(slotIdx, slot->sampleSize); //Forget repetitions
+    OnsetReset();
+    slotsChanges ++;
     slot->slotStatus = eLooperPlaying;
     looperStatus = eLooperPlaying;
-    RefreshDisplay("Loop Ok !");
-    ResetPlay(loopFound);
+    RefreshDisplay(F("Loop Ok !"));
+    ResetPlay(slotIdx, next, timestamp + wait);
+    MasterJoin(slotIdx, true);
     return false;
   }
   else //Message and wait for manual ack
   {
-    RefreshDisplay("Loop Ready!");
+    RefreshDisplay(F("Loop Ready!"));
     return false;
   }
 
@@ -344,21 +713,422 @@ byte NoteCb(byte channel, byte note, byte velocity, unsigned long timestamp)
 
 
 
+//Called on MIDI Start/Continue/Stop : the looper follows the clock master
+void ClockCb(tMIDIClockEvent event)
+{
+  byte s;
+
+  switch (event)
+  {
+    case eClockStart: //Loops start over, in sync with the song
+      for (s = 0; s < MAX_SLOTS; s++)
+      {
+        if (aSlots[s].sampleSize && (aSlots[s].slotStatus != eLooperRecording))
+          ResetPlay(s, 0, MIDIClockNow());
+      }
+      SetStatus(eLooperPlaying);
+    break;
+    case eClockContinue:
+      SetStatus(eLooperPlaying);
+    break;
+    case eClockStop:
+      if (looperStatus == eLooperPlaying)
+        generalPlayStopCb(0, eButtonStatus_Released, 0);
+    break;
+  }
+}
+
+
 // ######## SLOT SPECIFIC FUNCTIONS #########
 //Reset loop contents on current slot
 void ResetLoop(byte slot)
 {
+  slotsChanges ++;
+  QueueCancel(slot); //Stop playing it (pending NoteOff are kept)
   aSlots[slot].sampleSize         = 0;
   aSlots[slot].noteIdx            = 0;
   aSlots[slot].bChannel           = 0;
 
-  memset(aSlots[slot].aNoteEvents,    0x00, MAX_SAMPLE*sizeof(tNoteEvent));
+  StoreReset(slot);
+  if (dubSlot == slot) //Pending notes are lost
+    dubSlot = DUB_NONE;
+  if (masterSlot == slot) //Another loop leads, with its own timing
+  {
+    byte s;
+    masterSlot = MASTER_NONE;
+    for (s = 0; s < MAX_SLOTS; s++)
+    {
+      if (aSlots[s].sampleSize && (aSlots[s].slotStatus != eLooperRecording))
+      {
+        masterSlot = s;
+        break;
+      }
+    }
+  }
+  if (onsetSlot == slot) //Recording restarts
+  {
+    OnsetReset();
+    openCount  = 0;
+  }
+}
+//Decodes next note of slot s for playback
+void ReplayNext(byte s)
+{
+  tLooperSlot * slot = &aSlots[s];
+  tNoteEvent ev;
+
+  StoreNext(s, &slot->replayCursor, &ev);
+  slot->replayNote     = ev.note;
+  slot->replayVelocity = ev.velocity;
+  slot->replayDuration = DurationEncode(ev.duration);
+}
+
+//Reset play indexes : note playIdx will be played at timestamp
+void ResetPlay(byte s, byte playIdx, unsigned long timestamp)
+{
+  tLooperSlot * slot = &aSlots[s];
+  byte i;
+
+  StoreRewind(&slot->replayCursor);
+  for (i = 0; i <= playIdx; i++)
+    ReplayNext(s);
+  slot->replayIdx = playIdx;
+  slot->firstNoteTimestamp = timestamp - slot->replayCursor.time; //Compute a fake 1st note timestamp (roll back in time)
+  QueueCancel(s);
+  ScheduleNote(s);
+}
+
+//Queue slot's next note (replayIdx) for playback
+//Never fails : each slot has one NoteOn entry, and entries are kept for them (see LooperQueue.cpp)
+void ScheduleNote(byte s)
+{
+  tLooperSlot * slot = &aSlots[s];
+  QueuePush(slot->firstNoteTimestamp + slot->replayCursor.time, 0x90 | slot->bChannel, s);
+}
+
+//Loop length : last note time, then wait for first one (ticks)
+unsigned long LoopLength(byte s)
+{
+  return StoreLastTime(s) + aSlots[s].repeatDelay;
+}
+
+// ######## OVERDUB #########
+//Position of timestamp in slot's loop (ticks since loop start)
+unsigned long LoopPhase(byte s, unsigned long timestamp)
+{
+  unsigned long length = LoopLength(s);
+  long t = timestamp - aSlots[s].firstNoteTimestamp;
+
+  while (t < 0) //Waiting for next round
+    t += length;
+  return t % length;
+}
+
+//Merges a note into overdubbed slot, loop length is kept
+//Playback goes on : if the note is before the next note to play, it will be played on next round
+//With file loads, overdub is how a loop grows past what recording holds (2 rounds and their onsets) : up to the whole store
+boolean DubMerge(tDubNote * dub, unsigned long timestamp)
+{
+  tLooperSlot * slot = &aSlots[dubSlot];
+  unsigned long length = LoopLength(dubSlot);
+  unsigned int index;
+  tNoteEvent ev;
+  byte i;
+
+  if (slot->sampleSize == 0xFE) //noteIdx 0xFF is reserved
+    return false;
+  ev.time     = QuantTime(dub->time);
+  if (ev.time >= length) //Quantized to next round
+    ev.time -= length;
+  ev.note     = dub->note;
+  ev.velocity = dub->velocity;
+  ev.duration = min(QuantDuration(dub->time, dub->time + (unsigned int)((unsigned int)timestamp - dub->timestamp)), 0xFFFFUL);
+  index = StoreInsert(dubSlot, &ev);
+  if (index == STORE_FULL)
+    return false;
+
+  slot->sampleSize ++;
+  slot->noteIdx     = slot->sampleSize;
+  slot->repeatDelay = length - StoreLastTime(dubSlot);
+  if (index <= slot->replayIdx) //Next note to play moved : cursor follows it
+  {
+    slot->replayIdx ++;
+    StoreRewind(&slot->replayCursor);
+    for (i = 0; i <= slot->replayIdx; i++)
+      StoreNext(dubSlot, &slot->replayCursor, &ev);
+  }
+  slotsChanges ++;
+  return true;
+}
+
+//Note played on overdubbed slot
+void DubNote(byte note, byte velocity, unsigned long timestamp)
+{
+  byte i;
+
+  if (velocity)
+  {
+    if (dubCount == MAX_DUB) //Forget oldest note
+    {
+      dubCount --;
+      memmove(&aDubNotes[0], &aDubNotes[1], dubCount*sizeof(tDubNote));
+    }
+    aDubNotes[dubCount].note      = note;
+    aDubNotes[dubCount].velocity  = velocity;
+    aDubNotes[dubCount].time      = LoopPhase(dubSlot, timestamp);
+    aDubNotes[dubCount].timestamp = timestamp;
+    dubCount ++;
+    return;
+  }
+
+  for (i = 0; i < dubCount; i++)
+  {
+    if (aDubNotes[i].note != note)
+      continue;
+    if (!DubMerge(&aDubNotes[i], timestamp))
+    {
+      dubSlot = DUB_NONE;
+      RefreshDisplay(F("Too long !"));
+      return;
+    }
+    dubCount --;
+    memmove(&aDubNotes[i], &aDubNotes[i+1], (dubCount - i)*sizeof(tDubNote));
+    return;
+  }
+}
+
+//Ends overdub, notes still pressed end now
+void DubStop(unsigned long timestamp)
+{
+  byte i;
+
+  for (i = 0; i < dubCount; i++)
+  {
+    if (!DubMerge(&aDubNotes[i], timestamp))
+      break;
+  }
+  dubSlot = DUB_NONE;
+}
+
+// ######## SHARED TRANSPORT #########
+//Sets slot's length to the nearest multiple or divisor of master loop length
+//Divisors are exact only : the slot never drifts from the master
+void MasterSnap(byte s)
+{
+  unsigned long master = LoopLength(masterSlot);
+  unsigned long last   = StoreLastTime(s);
+  unsigned long length = LoopLength(s);
+  unsigned long best = 0, target;
+  byte k, i;
+
+  if (!master || !length) //No timing to follow (empty loop)
+    return;
+  for (k = 1; k <= MASTER_RATIOS; k++)
+  {
+    for (i = 0; i < 2; i++)
+    {
+      if (i && (master % k)) //Not an exact divisor
+        break;
+      target = i ? master / k : master * k;
+      if ((target <= last) || (target - last > 0xFFFF)) //Notes would overlap next round, or repeatDelay overflow
+        continue;
+      if (!best || (labs((long)(target - length)) < labs((long)(best - length))))
+        best = target;
+    }
+  }
+  if (best)
+    aSlots[s].repeatDelay = best - last;
+}
+
+//Moves slot's loop start to the nearest master loop start (or division of it), playback goes on from there
+void MasterAlign(byte s, unsigned long timestamp)
+{
+  tLooperSlot * slot = &aSlots[s];
+  unsigned long length = LoopLength(s);
+  unsigned long master = LoopLength(masterSlot);
+  unsigned long unit   = min(master, length);
+  unsigned long phase;
+  long shift;
+  tStoreCursor cur;
+  tNoteEvent ev;
+  byte i;
+
+  if (!master || !length) //No timing to follow (empty loop), LoopPhase needs a length
+    return;
+  shift = (long)(slot->firstNoteTimestamp - aSlots[masterSlot].firstNoteTimestamp) % (long)unit;
+  if (shift < 0)
+    shift += unit;
+  if (shift < (long)(unit >> 1))
+    slot->firstNoteTimestamp -= shift;
+  else
+    slot->firstNoteTimestamp += unit - shift;
+
+  //Next note to play from there : notes already passed wait for next round
+  phase = LoopPhase(s, timestamp);
+  StoreRewind(&cur);
+  for (i = 0; StoreNext(s, &cur, &ev) && (ev.time < phase); i++)
+    ;
+  if (i == slot->sampleSize)
+    ResetPlay(s, 0, timestamp - phase + length);
+  else
+    ResetPlay(s, i, timestamp - phase + ev.time);
+}
+
+//Accepted loop joins the shared transport (first one becomes the master)
+void MasterJoin(byte s, boolean snap)
+{
+  if ((masterSlot == MASTER_NONE) || (masterSlot == s))
+  {
+    masterSlot = s;
+    return;
+  }
+  if (snap)
+    MasterSnap(s);
+  MasterAlign(s, MIDIClockNow());
+}
+
+// ######## SLOTS PERSISTENCE #########
+//Slots image : slot count, then for each slot SLOT_IMAGE_HEADER bytes, then packed events of each slot
+//Packed events saved for a slot (none while recording : not a loop yet)
+unsigned int SlotImageEvents(byte s)
+{
+  if ((aSlots[s].slotStatus == eLooperRecording) || !aSlots[s].sampleSize)
+    return 0;
+  return StoreLength(s);
+}
+
+unsigned int SlotsImageLength()
+{
+  unsigned int len = 1 + MAX_SLOTS*SLOT_IMAGE_HEADER;
+  byte s;
+
+  for (s = 0; s < MAX_SLOTS; s++)
+    len += SlotImageEvents(s);
+  return len;
+}
+
+//Byte pos of slots image (called by background save)
+byte SlotsImageByte(unsigned int pos)
+{
+  byte s;
+
+  if (!pos)
+    return MAX_SLOTS;
+  pos --;
+
+  if (pos < MAX_SLOTS*SLOT_IMAGE_HEADER)
+  {
+    tLooperSlot * slot = &aSlots[pos / SLOT_IMAGE_HEADER];
+    unsigned int len = SlotImageEvents(pos / SLOT_IMAGE_HEADER);
+
+    switch (pos % SLOT_IMAGE_HEADER)
+    {
+      case 0: return slot->bChannel;
+      case 1: return len ? slot->sampleSize : 0;
+      case 2: return lowByte(slot->repeatDelay);
+      case 3: return highByte(slot->repeatDelay);
+      case 4: return lowByte(len);
+      default: return highByte(len);
+    }
+  }
+  pos -= MAX_SLOTS*SLOT_IMAGE_HEADER;
+
+  for (s = 0; s < MAX_SLOTS; s++)
+  {
+    if (pos < SlotImageEvents(s))
+      return StoreByte(s, pos);
+    pos -= SlotImageEvents(s);
+  }
+  return 0;
+}
+
+//Restores slots from last EEPROM image, slots are restored muted and ready to play
+void LoadSlots()
+{
+  unsigned int aLength[MAX_SLOTS];
+  unsigned int i;
+  byte s, count;
+
+  if (SaveOpen() < 1)
+    return;
+  count = SaveRead();
+
+  for (s = 0; s < count; s++)
+  {
+    byte header[SLOT_IMAGE_HEADER];
+    for (i = 0; i < SLOT_IMAGE_HEADER; i++)
+      header[i] = SaveRead();
+    if (s >= MAX_SLOTS)
+      continue;
+    aSlots[s].bChannel    = header[0] & 0x0F;
+    aSlots[s].sampleSize  = header[1];
+    aSlots[s].repeatDelay = header[2] | (header[3] << 8);
+    aLength[s]            = header[4] | (header[5] << 8);
+  }
+
+  for (s = 0; (s < count) && (s < MAX_SLOTS); s++)
+  {
+    for (i = 0; i < aLength[s]; i++)
+    {
+      if (!StorePutByte(s, SaveRead()))
+        break;
+    }
+    if (i < aLength[s])
+      ResetLoop(s);
+    else
+      LooperSlotLoad(s, aSlots[s].bChannel, aSlots[s].sampleSize, aSlots[s].repeatDelay);
+  }
+}
+
+// ######## SLOTS ACCESS (transfers) #########
+//Incremented each time a loop is added or removed
+byte LooperChanges()
+{
+  return slotsChanges;
+}
+
+//Loop of a slot, returns false if slot has no loop (empty or recording)
+boolean LooperSlotInfo(byte s, byte * channel, byte * sampleSize, unsigned int * repeatDelay)
+{
+  if (!SlotImageEvents(s))
+    return false;
+  *channel     = aSlots[s].bChannel;
+  *sampleSize  = aSlots[s].sampleSize;
+  *repeatDelay = aSlots[s].repeatDelay;
+  return true;
+}
+
+//Empties a slot, so that its events can be loaded (StoreAppend)
+void LooperSlotClear(byte s)
+{
+  if (aSlots[s].slotStatus == eLooperPlaying)
+    ChannelAllOff(aSlots[s].bChannel);
+  ResetLoop(s);
+  aSlots[s].slotStatus = eLooperIdle;
+  RefreshDisplay();
 }
-//Reset play indexes
-void ResetPlay(byte playIdx)
+
+//Slot events are loaded : check them and get ready to play (muted)
+boolean LooperSlotLoad(byte s, byte channel, byte sampleSize, unsigned int repeatDelay)
 {
-  aSlots[slotIdx].replayIdx = playIdx;
-  aSlots[slotIdx].firstNoteTimestamp = millis() - aSlots[slotIdx].aNoteEvents[playIdx].time; //Compute a fake 1st note timestamp (roll back in time)
+  tLooperSlot * slot = &aSlots[s];
+
+  //Check events and reference last one for further appends
+  if (!sampleSize || (StoreTruncate(s, sampleSize) != sampleSize))
+  {
+    ResetLoop(s);
+    return false;
+  }
+  slot->bChannel    = channel & 0x0F;
+  slot->sampleSize  = sampleSize;
+  slot->repeatDelay = repeatDelay;
+  slot->noteIdx     = sampleSize;
+  slot->slotStatus  = eLooperIdle;
+  slotsChanges ++;
+  ResetPlay(s, 0, MIDIClockNow());
+  MasterJoin(s, false); //Saved length is kept
+  RefreshDisplay();
+  return true;
 }
 
 // ######## GENERAL LOOPER FUNCTIONS #########
@@ -386,13 +1156,24 @@ void SetGlobalMode(tLooperMode mode)
 }
 
 //Main Display method
-void RefreshDisplay(const char * msg) //7chars max
+//Display is drawn later, when no MIDI is due (callbacks may call it several times)
+void RefreshDisplay(const __FlashStringHelper * msg) //7chars max
+{
+  displayMsg = msg;
+  displayTimeout = msg ? millis() : 0;
+  if (!TaskDefer(DrawDisplay))
+    DrawDisplay();
+}
+
+void DrawDisplay()
 {
+  if (debugPage != DEBUG_CLOSED) //Inspector shown
+    return;
   DisplayClear();
 
 /*
    X|Auto|Ch07|Sl 4
-   ............Rec.
+   ...#......  Play
 
 */
 
@@ -406,18 +1187,18 @@ void RefreshDisplay(const char * msg) //7chars max
       DisplayWriteChar(0, 0,0);
     break;
   }
-  DisplayWriteStr((looperMode==eLooperManual)?"|Man |":"|Auto|", 0, 1);
+  DisplayWriteStr((looperMode==eLooperManual)?F("|Man |"):F("|Auto|"), 0, 1);
 
   if (aSlots[slotIdx].sampleSize)
   {
-    DisplayWriteStr("Ch00|", 0, 7);
+    DisplayWriteStr(F("Ch00|"), 0, 7);
     DisplayWriteInt(aSlots[slotIdx].bChannel+1, 0, (aSlots[slotIdx].bChannel>9)?9:10); //Ch01 - Ch16
   }
   else
   {
-    DisplayWriteStr("ChXX|", 0, 7);
+    DisplayWriteStr(F("ChXX|"), 0, 7);
   }
-  DisplayWriteStr("Sl ", 0, 12);
+  DisplayWriteStr(F("Sl "), 0, 12);
   DisplayWriteInt(slotIdx+1, 0, 15);
   
   //2nd line
@@ -425,38 +1206,58 @@ void RefreshDisplay(const char * msg) //7chars max
   {
     case eLooperIdle:
       if (!aSlots[slotIdx].sampleSize)
-        DisplayWriteStr("Empt", 1, 12);
+        DisplayWriteStr(F("Empt"), 1, 12);
       else
-        DisplayWriteStr("Mute", 1, 12);
+        DisplayWriteStr(F("Mute"), 1, 12);
     break;
     case eLooperPlaying:
-      DisplayWriteStr("Play", 1, 12);
+      DisplayWriteStr((dubSlot == slotIdx) ? F("Dub.") : F("Play"), 1, 12);
     break;
     case eLooperRecording:
-      DisplayWriteStr("Rec.", 1, 12);
+      DisplayWriteStr(F("Rec."), 1, 12);
     break;
   }
 
   
   //Custom message
-  if (msg)
-  {
-    DisplayWriteStr(msg, 1, 0);
-    displayTimeout = millis();
-  }
+  if (displayMsg)
+    DisplayWriteStr(displayMsg, 1, 0);
   else
+    DrawPosition(MIDIClockNow());
+}
+
+//Current slot's loop position, as a cursor moving on POSITION_CELLS cells
+//Only changed cells are sent to the LCD : drawing it on each update is cheap
+void DrawPosition(unsigned long timestamp)
+{
+  tLooperSlot * slot = &aSlots[slotIdx];
+  unsigned long length, elapsed;
+  byte i, cell;
+
+  if (displayTimeout) //Message shown
+    return;
+  if (!slot->sampleSize || (slot->slotStatus == eLooperRecording))
   {
-    displayTimeout = 0;
+    DisplayWriteStr(F("          "), 1, 0);
+    return;
   }
+
+  length  = LoopLength(slotIdx);
+  elapsed = timestamp - slot->firstNoteTimestamp;
+  if ((long)elapsed < 0) //Waiting for next round
+    cell = ((long)elapsed < -(long)slot->repeatDelay) ? 0 : POSITION_CELLS - 1;
+  else
+    cell = (elapsed >= length) ? POSITION_CELLS - 1 : elapsed * POSITION_CELLS / length;
+
+  for (i = 0; i < POSITION_CELLS; i++)
+    DisplayWriteChar((i == cell) ? 0xFF : '.', 1, i); //0xFF : full block
 }
 
 //Sends a "All note off" message to stop all pending notes.
 void ChannelAllOff(byte channel)
 {
   //Write 0xB<channel> 0x7B 0x00
-  Serial.write(0xB0 | channel);
-  Serial.write(0x7B);
-  Serial.write((byte)0x00);
+  MIDISend(eMIDIOutUrgent, 3, 0xB0 | channel, 0x7B, 0x00);
 }
 
 
@@ -492,6 +1293,8 @@ void slotPlayMuteCb(byte button, tButtonStatus event, int duration) //Change sta
   }
   else if (aSlots[slotIdx].slotStatus == eLooperPlaying) //Loop (if loop found)
   {
+    if (dubSlot == slotIdx)
+      DubStop(MIDIClockNow());
     ChannelAllOff(aSlots[slotIdx].bChannel);
     aSlots[slotIdx].slotStatus = eLooperIdle;
   }
@@ -499,21 +1302,27 @@ void slotPlayMuteCb(byte button, tButtonStatus event, int duration) //Change sta
   {
     if (aSlots[slotIdx].sampleSize) //Manual enable
     {
-      ResetPlay(0);      //TODO: start playing at appropriate note !          
+      StoreTruncate(slotIdx, aSlots[slotIdx].sampleSize); //Forget repetitions
+      OnsetReset();
+      slotsChanges ++;
+      ResetPlay(slotIdx, 0, MIDIClockNow());      //TODO: start playing at appropriate note !          
+      MasterJoin(slotIdx, true);
 
       aSlots[slotIdx].slotStatus = eLooperPlaying;
       looperStatus = eLooperPlaying;
     }
     else //No loop
     {
-      RefreshDisplay("NoLoop!");
+      RefreshDisplay(F("NoLoop!"));
       return;
     }
   }
   else
   {
+    if (aSlots[slotIdx].slotStatus == eLooperRecording) //Take abandoned : its blocks are given back
+      ResetLoop(slotIdx);
     aSlots[slotIdx].slotStatus = eLooperIdle;
-    RefreshDisplay("NoLoop!");
+    RefreshDisplay(F("NoLoop!"));
     return;
   }
   RefreshDisplay();
@@ -522,6 +1331,27 @@ void slotPlayMuteCb(byte button, tButtonStatus event, int duration) //Change sta
 //## Button 2 (long press) : Switch current slot to Recording status
 void slotRecordCb(byte button, tButtonStatus event, int duration) //Start Recording
 {
+  if (dubSlot == slotIdx) //Stop overdub
+  {
+    DubStop(MIDIClockNow());
+    RefreshDisplay();
+    return;
+  }
+  if ((aSlots[slotIdx].slotStatus == eLooperPlaying) && aSlots[slotIdx].sampleSize) //Overdub playing loop
+  {
+    if (dubSlot != DUB_NONE)
+      DubStop(MIDIClockNow());
+    dubSlot  = slotIdx;
+    dubCount = 0;
+    RefreshDisplay(F("Overdub"));
+    return;
+  }
+  if ((onsetSlot != slotIdx) && (aSlots[onsetSlot].slotStatus == eLooperRecording)) //One take at a time : unfinished one is dropped
+  {
+    ResetLoop(onsetSlot);
+    aSlots[onsetSlot].slotStatus = eLooperIdle;
+  }
+  onsetSlot = slotIdx;
   ResetLoop(slotIdx);
   aSlots[slotIdx].slotStatus = eLooperRecording;
   RefreshDisplay();
@@ -541,6 +1371,16 @@ void changeLooperModeCb(byte button, tButtonStatus event, int duration) //Change
   }
 }
 
+//## Button 1 (long press) : Save slots in EEPROM (in background)
+void saveSlotsCb(byte button, tButtonStatus event, int duration)
+{
+  saveChanges = slotsChanges;
+  if (SaveStart(SlotsImageLength(), SlotsImageByte))
+    RefreshDisplay(F("Saving"));
+  else
+    RefreshDisplay(F("TooBig!"));
+}
+
 // ######## KNOBS CALLBACKS #########
 //## Knob 1 : Select slot
 void slotSelectCb (byte knob, int value, tKnobRotate rot)
@@ -550,51 +1390,233 @@ void slotSelectCb (byte knob, int value, tKnobRotate rot)
   if (v == slotIdx)
     return;
   
+  if (dubSlot != DUB_NONE)
+    DubStop(MIDIClockNow());
   slotIdx = v;
   RefreshDisplay();
 }
 
+//Setting selected by a knob position, among levels (reversed, as slots)
+byte KnobLevel(int value, byte levels)
+{
+  return levels - ((long)value * levels/1024) - 1;
+}
+
+//Name of the quantization setting knob 2 changes (flash)
+const __FlashStringHelper * QuantEditName()
+{
+  switch (quantEdit)
+  {
+    case eQuantEditStrength:
+      return (const __FlashStringHelper *)aStrengthNames[quantStrength];
+    case eQuantEditSwing:
+      return (const __FlashStringHelper *)aSwingNames[quantSwing];
+    default:
+      return (const __FlashStringHelper *)aQuantNames[quantGrid];
+  }
+}
+
+//## Knob 2 : Select quantization grid, strength or swing (inspector paging when shown)
+void quantKnobCb (byte knob, int value, tKnobRotate rot)
+{
+  byte * setting = &quantGrid;
+  byte v = KnobLevel(value, QUANT_GRIDS);
+
+  if (debugPage != DEBUG_CLOSED) //Inspector paging (debugPageCb)
+    return;
+  if (quantEdit == eQuantEditStrength)
+  {
+    setting = &quantStrength;
+    v = KnobLevel(value, QUANT_STRENGTHS);
+  }
+  else if (quantEdit == eQuantEditSwing)
+  {
+    setting = &quantSwing;
+    v = KnobLevel(value, QUANT_SWINGS);
+  }
+  if (v == *setting)
+    return;
+  *setting = v;
+  RefreshDisplay(QuantEditName());
+}
+
+//## Button 3 (double press) : Next quantization setting of knob 2 (the two presses also change mode twice : unchanged)
+//The setting keeps its value until knob 2 is moved
+void quantEditCb(byte button, tButtonStatus event, int duration)
+{
+  quantEdit = (quantEdit + 1) % eQuantEditCount;
+  RefreshDisplay(QuantEditName());
+}
+
 
 #ifdef _DEBUG
+//Opens the inspector on current slot (or closes it)
 void dumpLoopCb(byte button, tButtonStatus event, int duration)
 {
-  int i;
-  DisplayClear();
-  
-  DisplayWriteStr("Debug ...      ", 0, 0);
-  delay(1000);
-  DisplayWriteStr("Mode :         ", 0, 0);
-  DisplayWriteStr((looperMode==eLooperManual)?"Manual":"Auto", 0, 7);
-  delay(1000);
-  DisplayWriteStr("Status :       ", 0, 0);
-  DisplayWriteStr(looperStatus==eLooperIdle?"Idle":(looperStatus==eLooperPlaying?"Playing":"Recording"), 0, 9);
-  delay(1000);
-  DisplayWriteStr("SampleSize :   ", 0, 0);
-  DisplayWriteInt(aSlots[slotIdx].sampleSize, 0, 13);
-  delay(1000);
-
-
-  if (!aSlots[slotIdx].sampleSize) 
-  {
-    DisplayWriteStr("No Sample", 0, 0);
-    delay(1000);
+  if (debugPage != DEBUG_CLOSED)
+  {
+    DebugClose();
+    return;
+  }
+  debugPage = 0;
+  debugDrawn = DEBUG_CLOSED;
+  debugAuto = true;
+  debugTime = millis();
+}
+
+//Knob 2 : selects inspector page (stops auto paging)
+void debugPageCb(byte knob, int value, tKnobRotate rot)
+{
+  unsigned int pages = DEBUG_INFO_PAGES + aSlots[slotIdx].sampleSize;
+
+  if (debugPage == DEBUG_CLOSED)
     return;
+  debugAuto = false;
+  debugPage = pages - ((long)value * pages / 1024) - 1;
+}
+#endif
+
+void DebugClose()
+{
+  debugPage = DEBUG_CLOSED;
+  RefreshDisplay();
+}
+
+//Draws current inspector page, moves to next one in auto paging (called by LooperUI)
+void DebugUpdate()
+{
+  tLooperSlot * slot = &aSlots[slotIdx];
+  tStoreCursor cur;
+  tNoteEvent ev;
+  unsigned int i, pages = DEBUG_INFO_PAGES + slot->sampleSize;
+
+  if (debugAuto && ((millis() - debugTime) > DEBUG_PAGE_MS))
+  {
+    debugTime = millis();
+    if (++debugPage >= pages) //Done
+    {
+      DebugClose();
+      return;
+    }
   }
-  delay(1000);
-  DisplayWriteStr("[ ]   n       ms", 0, 0);
-  DisplayWriteStr("Dur. :        ms",       1, 0);
-  for (i = 0; i < aSlots[slotIdx].sampleSize; i++)
+  if (debugPage >= pages) //Slot changed
+    debugPage = pages - 1;
+
+  //Slot pages are drawn on each call (live values)
+  if (debugPage < DEBUG_INFO_PAGES)
   {
-    //[4]   n67 1234ms
-    //Dur. : 1200   ms
-    DisplayWriteInt(i, 0, 1);
-    DisplayWriteInt(aSlots[slotIdx].aNoteEvents[i].note, 0, 7);
-    DisplayWriteInt(aSlots[slotIdx].aNoteEvents[i].time, 0, 10);
-    DisplayWriteInt(aSlots[slotIdx].aNoteEvents[i].duration, 1, 7);
-    delay(1500);
+    DisplayClear();
+    if (debugPage == 0)
+    {
+      DisplayWriteStr(F("Mode :"), 0, 0);
+      DisplayWriteStr((looperMode==eLooperManual)?F("Manual"):F("Auto"), 0, 9);
+      DisplayWriteStr(F("Status:"), 1, 0);
+      DisplayWriteStr(looperStatus==eLooperIdle?F("Idle"):(looperStatus==eLooperPlaying?F("Playing"):F("Recording")), 1, 7);
+    }
+    else if (debugPage == 1)
+    {
+      DisplayWriteStr(F("SampleSize :"), 0, 0);
+      DisplayWriteInt(slot->sampleSize, 0, 13);
+      DisplayWriteStr(F("Delay :"), 1, 0);
+      DisplayWriteInt(slot->repeatDelay, 1, 9);
+    }
+    else if (debugPage == 2)
+    {
+      //In   123456
+      //D 0     E 2      (dropped, errors)
+      DisplayWriteStr(F("In"), 0, 0);
+      DisplayWriteLong(MIDIInBytes(), 0, 5);
+      DisplayWriteStr(F("D"), 1, 0);
+      DisplayWriteLong(MIDIInDropped(), 1, 2);
+      DisplayWriteStr(F("E"), 1, 8);
+      DisplayWriteLong(MIDIInErrors(), 1, 10);
+    }
+    else if (debugPage == 3)
+    {
+      //Out U12 N3  B9   (output queues high water : urgent, normal, bulk)
+      //D 0              (dropped)
+      DisplayWriteStr(F("Out U   N   B"), 0, 0);
+      DisplayWriteInt(MIDIOutHighWater(eMIDIOutUrgent), 0, 5);
+      DisplayWriteInt(MIDIOutHighWater(eMIDIOutNormal), 0, 9);
+      DisplayWriteInt(MIDIOutHighWater(eMIDIOutBulk), 0, 13);
+      DisplayWriteStr(F("D"), 1, 0);
+      DisplayWriteLong(MIDIOutDropped(), 1, 2);
+    }
+    else if (debugPage < DEBUG_SLOT_PAGES + eProfileCount)
+    {
+      DebugProfile(debugPage - DEBUG_SLOT_PAGES);
+    }
+    else
+    {
+      DebugTasks();
+    }
+    debugDrawn = debugPage;
+    return;
   }
 
-  RefreshDisplay();
+  //Event pages : events are decoded from start of slot, only when page changes
+  if ((debugDrawn == debugPage) && (debugChanges == slotsChanges))
+    return;
+  debugDrawn   = debugPage;
+  debugChanges = slotsChanges;
+
+  StoreRewind(&cur);
+  for (i = DEBUG_INFO_PAGES; (i <= debugPage) && StoreNext(slotIdx, &cur, &ev); i++)
+    ;
+  //Ev 4/12   n67
+  //T 1234    D 120
+  DisplayClear();
+  DisplayWriteStr(F("Ev   /    n"), 0, 0);
+  DisplayWriteInt(debugPage - DEBUG_INFO_PAGES + 1, 0, 2);
+  DisplayWriteInt(slot->sampleSize, 0, 6);
+  DisplayWriteInt(ev.note, 0, 11);
+  DisplayWriteStr(F("T"), 1, 0);
+  DisplayWriteLong(ev.time, 1, 2);
+  DisplayWriteStr(F("D"), 1, 10);
+  DisplayWriteInt(ev.duration, 1, 11);
 }
-#endif
 
+//Timing page : shortest and longest run (us, ticks for lateness), then histogram
+//Each bucket shows its share of runs (0-9, 1 if any), '!' : runs over limit
+//Loop  12-  340
+//H 8 1 1 0 0 0  !
+void DebugProfile(byte zone)
+{
+  tProfileStats * p = ProfileStats(zone);
+  unsigned long total = 0;
+  byte i;
+
+  DisplayWriteStr((const __FlashStringHelper *)aProfileNames[zone], 0, 0);
+  if (p->min > p->max) //Not run yet
+  {
+    DisplayWriteStr(F("-"), 0, 5);
+    return;
+  }
+  DisplayWriteLong(p->min, 0, 5);
+  DisplayWriteStr(F("-"), 0, 10);
+  DisplayWriteLong(p->max, 0, 11);
+
+  for (i = 0; i < PROFILE_BUCKETS; i++)
+    total += p->aBuckets[i];
+  DisplayWriteStr(F("H"), 1, 0);
+  for (i = 0; i < PROFILE_BUCKETS; i++)
+    DisplayWriteChar('0' + (p->aBuckets[i] * 9UL + total - 1) / total, 1, 2 + 2*i);
+  if (p->over)
+    DisplayWriteChar('!', 1, 15);
+}
+
+//Task overruns page : runs over budget of each task (see Moopz.ino), in TaskAdd order, 3 per line (999 : more)
+//Over 0   0   2
+//     0   14  0
+void DebugTasks()
+{
+  unsigned int over;
+  byte i;
+
+  DisplayWriteStr(F("Over"), 0, 0);
+  for (i = 0; i < TaskCount(); i++)
+  {
+    over = TaskOverruns(i);
+    DisplayWriteInt((over > 999) ? 999 : over, i / 3, 5 + 4*(i % 3));
+  }
+}
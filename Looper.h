@@ -1,3 +1,86 @@
+#include "Arduino.h"
+
+#define MAX_SLOTS 8
 
 void LooperSetup();
-void LooperUpdate();
+void LooperUpdate();      //Plays due events
+void LooperBackground();  //Transfers and saves
+void LooperUI();          //Messages and loop position
+unsigned long LooperSlack();
+
+//Slots access, for transfers
+byte    LooperChanges();
+boolean LooperSlotInfo(byte slot, byte * channel, byte * sampleSize, unsigned int * repeatDelay);
+void    LooperSlotClear(byte slot);
+boolean LooperSlotLoad(byte slot, byte channel, byte sampleSize, unsigned int repeatDelay);
+
+
+//Recorded note, as decoded from the store (see LooperStore.cpp)
+typedef struct
+{
+  unsigned long time;     //Ticks since loop start (see MIDIClock.cpp)
+  byte          note;
+  byte          velocity;
+  unsigned int  duration; //Ticks (quantized)
+} tNoteEvent;
+
+//Reading position in a slot's events
+typedef struct
+{
+  unsigned int  pos;   //Next event offset in slot
+  byte          block; //Block being read
+  byte          at;    //Next byte in block
+  unsigned long time;  //Time of previous event
+} tStoreCursor;
+
+#define STORE_FULL  0xFFFF
+#define STORE_NONE  0xFF   //No block
+#define STORE_BLOCK 16     //Block size (link + events)
+
+void         StoreSetup();
+void         StoreReset(byte slot);
+unsigned int StoreAppend(byte slot, tNoteEvent * ev);
+unsigned int StoreInsert(byte slot, tNoteEvent * ev);
+void         StoreSetDuration(byte slot, unsigned int handle, unsigned long duration);
+void         StoreRewind(tStoreCursor * cur);
+boolean      StoreNext(byte slot, tStoreCursor * cur, tNoteEvent * ev);
+byte         StoreTruncate(byte slot, byte count);
+unsigned long StoreLastTime(byte slot);
+unsigned int StoreLength(byte slot);
+byte         StoreByte(byte slot, unsigned int pos);
+boolean      StorePutByte(byte slot, byte b);
+byte         StoreTake();            //Lends a whole free block (STORE_NONE if none)
+void         StoreGive(byte block);  //Gives it back
+byte *       StoreBlock(byte block);
+byte         DurationEncode(unsigned long duration); //1 byte, see LooperStore.cpp
+unsigned int DurationDecode(byte q);
+
+
+//Slots persistence in EEPROM (see LooperSave.cpp)
+typedef byte (* tSaveSource) (unsigned int pos);
+
+unsigned int SaveOpen();
+byte         SaveRead();
+boolean      SaveStart(unsigned int len, tSaveSource source);
+boolean      SaveBusy();
+boolean      SaveUpdate();
+
+
+//Slots transfers as Standard MIDI Files over SysEx (see LooperSMF.cpp)
+void SMFSetup();
+void SMFUpdate();
+
+
+//Scheduled MIDI event (see LooperQueue.cpp)
+typedef struct
+{
+  unsigned long due;  //When to play it (transport ticks)
+  byte status;        //0x9n : slot's next note, 0x8n : note release
+  byte note;          //NoteOn : slot, NoteOff : released note (released with MIDI_RELEASE_DEFAULT)
+} tPendingEvent;
+
+void    QueueReset();
+boolean QueuePush(unsigned long due, byte status, byte note);
+boolean QueuePop(unsigned long timestamp, tPendingEvent * ev);
+boolean QueueNext(unsigned long * due);
+void    QueueCancel(byte slot);
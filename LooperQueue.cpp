@@ -0,0 +1,133 @@
+#include "Arduino.h"
+#include "Looper.h"
+
+/*
+-- Pending events queue :
+Min-heap of every scheduled MIDI event (all slots), ordered on due time.
+Each slot owns one NoteOn entry (its next note to play), each sounding note owns one NoteOff entry.
+MAX_SLOTS entries are kept for NoteOns : NoteOffs are refused past MAX_PENDING - MAX_SLOTS (the note is then
+played short), so that rescheduling a slot never fails and no loop stops.
+LooperUpdate only pops events which are due, whatever the number of slots or loop length.
+*/
+
+/***********************************
+ *     Queue configuration
+ ***********************************/
+#define MAX_PENDING 16  //Max scheduled events : 1 NoteOn per slot + sounding loop notes (8 : 2 notes chords on 4 slots)
+#define MAX_RELEASES (MAX_PENDING - MAX_SLOTS) //Max NoteOff entries
+
+tPendingEvent aPending[MAX_PENDING];
+byte pendingCount = 0;
+
+
+//Should event a be played before event b ? (NoteOff first on same date)
+boolean QueueBefore(tPendingEvent * a, tPendingEvent * b)
+{
+  long diff = (long)(a->due - b->due); //Wrap safe
+
+  if (diff)
+    return (diff < 0);
+  return (a->status < b->status);
+}
+
+void QueueSwap(byte i, byte j)
+{
+  tPendingEvent tmp = aPending[i];
+  aPending[i] = aPending[j];
+  aPending[j] = tmp;
+}
+
+void QueueSiftUp(byte i)
+{
+  while (i)
+  {
+    byte parent = (i - 1) >> 1;
+    if (!QueueBefore(&aPending[i], &aPending[parent]))
+      return;
+    QueueSwap(i, parent);
+    i = parent;
+  }
+}
+
+void QueueSiftDown(byte i)
+{
+  while (true)
+  {
+    byte first = i;
+    byte left  = 2*i + 1;
+    byte right = left + 1;
+
+    if ((left < pendingCount) && QueueBefore(&aPending[left], &aPending[first]))
+      first = left;
+    if ((right < pendingCount) && QueueBefore(&aPending[right], &aPending[first]))
+      first = right;
+    if (first == i)
+      return;
+    QueueSwap(i, first);
+    i = first;
+  }
+}
+
+void QueueReset()
+{
+  pendingCount = 0;
+}
+
+//Schedules an event (returns false if queue is full : NoteOffs only, NoteOns always have room)
+boolean QueuePush(unsigned long due, byte status, byte note)
+{
+  if (pendingCount >= (((status & 0xF0) == 0x80) ? MAX_RELEASES : MAX_PENDING))
+    return false;
+
+  aPending[pendingCount].due      = due;
+  aPending[pendingCount].status   = status;
+  aPending[pendingCount].note     = note;
+  pendingCount ++;
+  QueueSiftUp(pendingCount - 1);
+  return true;
+}
+
+//Pops next event if it is due at timestamp (returns false if nothing to play yet)
+boolean QueuePop(unsigned long timestamp, tPendingEvent * ev)
+{
+  if (!pendingCount || ((long)(timestamp - aPending[0].due) < 0))
+    return false;
+
+  *ev = aPending[0];
+  pendingCount --;
+  if (pendingCount)
+  {
+    aPending[0] = aPending[pendingCount];
+    QueueSiftDown(0);
+  }
+  return true;
+}
+
+//Due time of next event (returns false if queue is empty)
+boolean QueueNext(unsigned long * due)
+{
+  if (!pendingCount)
+    return false;
+  *due = aPending[0].due;
+  return true;
+}
+
+//Removes slot's NoteOn entry (sounding notes keep their NoteOff)
+void QueueCancel(byte slot)
+{
+  byte i, j = 0;
+
+  for (i = 0; i < pendingCount; i++)
+  {
+    if (((aPending[i].status & 0xF0) == 0x90) && (aPending[i].note == slot))
+      continue;
+    aPending[j++] = aPending[i];
+  }
+  if (j == pendingCount)
+    return;
+  pendingCount = j;
+
+  //Rebuild heap
+  for (i = pendingCount/2; i > 0; i--)
+    QueueSiftDown(i - 1);
+}
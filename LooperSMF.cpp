@@ -0,0 +1,826 @@
+#include "Arduino.h"
+#include "MIDIProcessor.h"
+#include "Looper.h"
+#include "Profile.h"
+
+/*
+-- Slots transfers :
+A slot is exchanged as a Standard MIDI File (format 0, one track), carried by SysEx packets :
+  F0 7D 4D <cmd> <slot> ... F7
+    - 01 : dump request (computer -> looper)
+    - 02 <seq> <groups> : file data (both ways), seq counts packets (7 bits, 0 on first packet of a file)
+           Each group is 7 file bytes sent as 8 : first byte holds bit 7 of the following ones (bit 0 for first one)
+    - 03 <result> : end of transfer, sent by the looper after a dump or a load (0 : ok, 1 : error)
+    - 04 : timing stats request (computer -> looper), slot byte is 1 to reset stats once sent
+      04 <zone> <groups> : timing stats of a zone (see Profile.h), one packet per zone
+           18 bytes in groups as above : min, max, histogram buckets, runs over limit (16 bits, most significant first)
+Dumped packets hold one group (15 bytes) : loop notes are delayed by less than 5ms while dumping.
+Files are generated and parsed on the fly, byte by byte : no copy of the file in RAM.
+Dumps generate the file twice : once to count the track length (SMF_COUNT_STEP bytes per SMFUpdate call), then to send it.
+Packets are only queued when bulk output has room : results wait in SMFUpdate when it has not.
+One transfer at a time : a dump request or a file received during another transfer is answered with an error.
+Dumped files use transport ticks (480 per quarter note) and current tempo, End of Track is the loop length.
+Loaded files may use any division : quarter notes are kept as is (tempo follows the clock), SMPTE times use current tempo.
+Notes of the first channel played, in the first track with notes, are kept. Notes without NoteOff end at End of Track.
+*/
+
+/***********************************
+ *     Transfers configuration
+ ***********************************/
+#define SMF_SYSEX_ID    0x7D  //Non commercial manufacturer ID
+#define SMF_SYSEX_DEV   0x4D  //'M'oopz
+#define SMF_CMD_REQUEST 0x01
+#define SMF_CMD_DATA    0x02
+#define SMF_CMD_RESULT  0x03
+#define SMF_CMD_STATS   0x04
+#define SMF_GROUP       7     //File bytes per dumped packet
+#define SMF_PACKET      15    //F0 7D 4D cmd slot seq, group (8), F7
+#define SMF_STATS       18    //Stats bytes per zone
+#define SMF_STATS_PACKET 27   //F0 7D 4D cmd zone, groups (8 + 8 + 5), F7
+#define SMF_RESULT_PACKET 7   //F0 7D 4D cmd slot result F7
+#define SMF_RESULTS     2     //Results waiting for bulk output room
+#define SMF_COUNT_STEP  16    //File bytes counted per SMFUpdate call (track length, before dumping)
+#define SMF_MAX_OFF     8     //Notes sounding while generating a file
+#define SMF_MAX_OPEN    8     //Notes sounding while parsing a file
+#define SMF_LAST_DELAY  480   //Loop end when file ends on its last note (ticks)
+
+#define SMF_MTHD        0x4D546864 //"MThd"
+#define SMF_MTRK        0x4D54726B //"MTrk"
+
+typedef struct
+{
+  unsigned long due;  //NoteOff time (ticks)
+  byte          note;
+} tSMFOff;
+
+typedef struct
+{
+  byte          note;
+  unsigned int  handle; //Store handle, to set duration
+  unsigned int  time;   //NoteOn time (ticks, 16 bits are enough for durations)
+} tSMFOpen;
+
+//File generation (dump)
+typedef enum
+{
+  eSMFWriteIdle,
+  eSMFWriteHeader,  //MThd chunk
+  eSMFWriteTrack,   //MTrk chunk header
+  eSMFWriteTempo,   //Set Tempo meta event
+  eSMFWriteEvents,
+  eSMFWriteDone     //End of Track written
+} tSMFWritePhase;
+
+tSMFWritePhase writePhase = eSMFWriteIdle;
+
+typedef struct
+{
+  byte          slot;
+  byte          channel;
+  byte          count;     //Notes left to write
+  unsigned int  delay;     //Slot repeat delay
+  byte          seq;       //Next packet seq
+  boolean       counting;  //Counting track length, nothing sent yet
+  byte          changes;   //LooperChanges when dump started
+  byte          status;    //Running status
+  unsigned long tempo;     //Quarter note length (us)
+  unsigned long time;      //Time of previous event (ticks)
+  unsigned long end;       //Loop length (ticks), known once last note is written
+  unsigned long trackLen;  //MTrk chunk length
+  tStoreCursor  cursor;
+  tNoteEvent    note;      //Next note to write
+  tSMFOff       aOffs[SMF_MAX_OFF];
+  byte          offCount;
+  byte          aOut[14];  //Next bytes of the file (largest is MThd chunk)
+  byte          outLen;
+  byte          outPos;
+} tSMFWriter;
+
+//File parsing (load)
+typedef enum
+{
+  eSMFReadIdle,
+  eSMFReadChunk,     //Chunk id and length
+  eSMFReadHeader,    //MThd contents
+  eSMFReadSkip,      //Unknown chunk contents
+  eSMFReadDelta,     //Event delta time
+  eSMFReadStatus,    //Event status (or first data byte on running status)
+  eSMFReadData,      //Channel message data bytes
+  eSMFReadMetaType,
+  eSMFReadLength,    //Meta event or SysEx length
+  eSMFReadMetaData,  //Meta event or SysEx contents
+  eSMFReadDone,
+  eSMFReadError
+} tSMFReadPhase;
+
+tSMFReadPhase readPhase = eSMFReadIdle;
+
+typedef struct
+{
+  byte          slot;
+  byte          seq;        //Expected packet seq
+  byte          groupPos;   //Byte index in 7-in-8 group
+  byte          msb;        //First byte of group
+  byte          channel;    //Channel kept (0xFF until first NoteOn)
+  byte          count;      //Notes loaded
+  unsigned long chunk;      //Chunk id
+  unsigned long value;      //Number being read (chunk length, delta, length)
+  byte          valuePos;
+  unsigned long left;       //Bytes left in chunk
+  unsigned long length;     //Bytes left in meta event or SysEx
+  unsigned int  division;
+  unsigned long tick;       //File tick length (1/16 ticks)
+  unsigned long remain;     //Time not counted yet (1/16 ticks)
+  unsigned long time;       //Current time (ticks)
+  unsigned long lastOn;     //Time of last NoteOn (ticks)
+  unsigned long prevOn;     //Time of NoteOn before last one (ticks)
+  byte          running;    //Running status
+  byte          meta;       //Meta event type (0 for SysEx)
+  byte          aData[2];
+  byte          dataPos;
+  tSMFOpen      aOpen[SMF_MAX_OPEN];
+  byte          openCount;
+} tSMFReader;
+
+//One transfer at a time (see SysExCb) : dump and load share their state
+static union
+{
+  tSMFWriter    writer;
+  tSMFReader    reader;
+};
+
+//Timing stats sending
+byte          statsZone = 0xFF; //Next zone to send (0xFF : none)
+boolean       statsReset;       //Reset stats once sent
+
+//End of transfer results waiting for room : slot, bit 7 set on error
+byte          aResults[SMF_RESULTS];
+byte          resultCount;
+
+//Incoming SysEx packet
+byte          sysexPos;       //Bytes received after F0 (0xFF : not for us)
+byte          sysexCmd;
+byte          sysexSlot;
+
+void SysExCb(tSysExEvent event, byte b);
+
+
+void SMFSetup()
+{
+  writePhase = eSMFWriteIdle;
+  readPhase  = eSMFReadIdle;
+  sysexPos   = 0xFF;
+  resultCount = 0;
+  MIDIRegisterSysExCb(SysExCb);
+}
+
+//Queues a packet on bulk output, 3 bytes per message (room must have been checked)
+void SMFSendPacket(byte * p, byte len)
+{
+  while (len)
+  {
+    byte n = (len > 3) ? 3 : len;
+    MIDISend(eMIDIOutBulk, n, p[0], (n > 1) ? p[1] : 0, (n > 2) ? p[2] : 0);
+    p   += n;
+    len -= n;
+  }
+}
+
+//Sends waiting results, in order, while bulk output has room
+void SMFSendResults()
+{
+  while (resultCount && (MIDIOutFree(eMIDIOutBulk) >= (SMF_RESULT_PACKET + 2) / 3))
+  {
+    byte aPacket[SMF_RESULT_PACKET] = {0xF0, SMF_SYSEX_ID, SMF_SYSEX_DEV, SMF_CMD_RESULT, 0, 0, 0xF7};
+
+    aPacket[4] = aResults[0] & 0x7F;
+    aPacket[5] = aResults[0] >> 7;
+
+    SMFSendPacket(aPacket, sizeof(aPacket));
+    resultCount --;
+    memmove(&aResults[0], &aResults[1], resultCount);
+  }
+}
+
+//Sends end of transfer packet, or keeps it for SMFUpdate if bulk output is full (dropped if too many wait)
+void SMFSendResult(byte slot, byte result)
+{
+  if (resultCount == SMF_RESULTS)
+    return;
+  aResults[resultCount++] = slot | (result << 7);
+  SMFSendResults();
+}
+
+
+// ######## FILE GENERATION #########
+byte * SMFWriteLong(byte * p, unsigned long value)
+{
+  *p++ = value >> 24;
+  *p++ = value >> 16;
+  *p++ = value >> 8;
+  *p++ = value;
+  return p;
+}
+
+//Variable length quantity, 7 bits per byte, most significant first
+byte * SMFWriteDelta(byte * p, unsigned long delta)
+{
+  byte shift = 21;
+
+  if (delta > 0x0FFFFFFF)
+    delta = 0x0FFFFFFF;
+  while (shift && !(delta >> shift))
+    shift -= 7;
+  for (; shift; shift -= 7)
+    *p++ = 0x80 | ((delta >> shift) & 0x7F);
+  *p++ = delta & 0x7F;
+  return p;
+}
+
+byte * SMFWriteEvent(byte * p, unsigned long time, byte status, byte data1, byte data2)
+{
+  if ((long)(time - writer.time) < 0)
+    time = writer.time;
+  p = SMFWriteDelta(p, time - writer.time);
+  writer.time = time;
+  if (status != writer.status)
+    *p++ = writer.status = status;
+  *p++ = data1;
+  *p++ = data2;
+  return p;
+}
+
+//Releases sounding note i (NoteOff at given time)
+byte * SMFWriteOff(byte * p, byte i, unsigned long time)
+{
+  p = SMFWriteEvent(p, time, 0x80 | writer.channel, writer.aOffs[i].note, 0x40);
+  writer.aOffs[i] = writer.aOffs[--writer.offCount];
+  return p;
+}
+
+//Prepares next bytes of the file in writer.aOut, returns false at end of file
+//NoteOn are read from the store in order, NoteOff are merged from sounding notes
+boolean SMFWriteFill()
+{
+  byte * p = writer.aOut;
+  byte i, first = 0;
+
+  switch (writePhase)
+  {
+    case eSMFWriteHeader:
+      p = SMFWriteLong(p, SMF_MTHD);
+      p = SMFWriteLong(p, 6);
+      *p++ = 0; *p++ = 0; //Format 0
+      *p++ = 0; *p++ = 1; //1 track
+      *p++ = highByte(CLOCK_PPQN);
+      *p++ = lowByte(CLOCK_PPQN);
+      writePhase = eSMFWriteTrack;
+    break;
+    case eSMFWriteTrack:
+      p = SMFWriteLong(p, SMF_MTRK);
+      p = SMFWriteLong(p, writer.trackLen);
+      writePhase = eSMFWriteTempo;
+    break;
+    case eSMFWriteTempo:
+      *p++ = 0x00;
+      *p++ = 0xFF;
+      *p++ = 0x51;
+      p = SMFWriteLong(p, 0x03000000 | writer.tempo);
+      writePhase = eSMFWriteEvents;
+    break;
+    case eSMFWriteEvents:
+      for (i = 1; i < writer.offCount; i++)
+      {
+        if ((long)(writer.aOffs[i].due - writer.aOffs[first].due) < 0)
+          first = i;
+      }
+
+      if (writer.offCount && (!writer.count || ((long)(writer.aOffs[first].due - writer.note.time) <= 0))) //NoteOff first on same date
+      {
+        //Notes still sounding at loop end are cut
+        p = SMFWriteOff(p, first, (!writer.count && ((long)(writer.aOffs[first].due - writer.end) > 0)) ? writer.end : writer.aOffs[first].due);
+      }
+      else if (writer.count)
+      {
+        if (writer.offCount == SMF_MAX_OFF) //Too many sounding notes : release one early
+          p = SMFWriteOff(p, first, writer.note.time);
+        p = SMFWriteEvent(p, writer.note.time, 0x90 | writer.channel, writer.note.note, writer.note.velocity);
+        writer.aOffs[writer.offCount].due  = writer.note.time + writer.note.duration;
+        writer.aOffs[writer.offCount].note = writer.note.note;
+        writer.offCount ++;
+
+        if (--writer.count)
+          StoreNext(writer.slot, &writer.cursor, &writer.note);
+        else
+          writer.end = writer.note.time + writer.delay;
+      }
+      else //End of Track at loop length
+      {
+        p = SMFWriteDelta(p, ((long)(writer.end - writer.time) > 0) ? writer.end - writer.time : 0);
+        *p++ = 0xFF;
+        *p++ = 0x2F;
+        *p++ = 0x00;
+        writePhase = eSMFWriteDone;
+      }
+    break;
+    default:
+      return false;
+  }
+  writer.outLen = p - writer.aOut;
+  writer.outPos = 0;
+  return true;
+}
+
+//Next byte of the file, returns false at end of file
+boolean SMFWriteByte(byte * b)
+{
+  if ((writer.outPos == writer.outLen) && !SMFWriteFill())
+    return false;
+  *b = writer.aOut[writer.outPos++];
+  return true;
+}
+
+//Starts generating file of writer.slot from given phase (returns false if slot has no loop)
+boolean SMFWriteRewind(tSMFWritePhase phase)
+{
+  if (!LooperSlotInfo(writer.slot, &writer.channel, &writer.count, &writer.delay))
+    return false;
+  StoreRewind(&writer.cursor);
+  StoreNext(writer.slot, &writer.cursor, &writer.note);
+  writer.status   = 0;
+  writer.time     = 0;
+  writer.end      = 0;
+  writer.offCount = 0;
+  writer.outLen   = 0;
+  writer.outPos   = 0;
+  writePhase    = phase;
+  return true;
+}
+
+//Starts dumping slot, track length is counted then packets are sent by SMFUpdate
+boolean SMFWriteStart(byte slot)
+{
+  writer.slot = slot;
+  writer.tempo = MIDIClockTempo();
+  if (!SMFWriteRewind(eSMFWriteTempo))
+    return false;
+  writer.trackLen = 0;
+  writer.counting = true;
+  writer.seq      = 0;
+  writer.changes  = LooperChanges();
+  return true;
+}
+
+//Counts next bytes of the track : events are generated twice, track length is needed first
+void SMFWriteCount()
+{
+  byte i, b;
+
+  for (i = 0; i < SMF_COUNT_STEP; i++)
+  {
+    if (!SMFWriteByte(&b)) //Track length known : start over from file start
+    {
+      SMFWriteRewind(eSMFWriteHeader);
+      writer.counting = false;
+      return;
+    }
+    writer.trackLen ++;
+  }
+}
+
+//Sends stats of next zone, if bulk output has room for it
+void SMFSendStats()
+{
+  tProfileStats * p = ProfileStats(statsZone);
+  byte aPacket[SMF_STATS_PACKET];
+  byte len = 5, group = 0;
+  unsigned int value;
+  byte i, b;
+
+  if (MIDIOutFree(eMIDIOutBulk) < (SMF_STATS_PACKET + 2) / 3)
+    return;
+
+  aPacket[0] = 0xF0;
+  aPacket[1] = SMF_SYSEX_ID;
+  aPacket[2] = SMF_SYSEX_DEV;
+  aPacket[3] = SMF_CMD_STATS;
+  aPacket[4] = statsZone;
+  for (i = 0; i < SMF_STATS; i++)
+  {
+    if (i < 4)
+      value = (i < 2) ? p->min : p->max;
+    else
+      value = (i < 16) ? p->aBuckets[(i - 4) >> 1] : p->over;
+    b = (i & 1) ? lowByte(value) : highByte(value);
+    if (!(i % SMF_GROUP))
+    {
+      group = len++;
+      aPacket[group] = 0;
+    }
+    aPacket[group] |= (b >> 7) << (i % SMF_GROUP);
+    aPacket[len++]  = b & 0x7F;
+  }
+  aPacket[len++] = 0xF7;
+  SMFSendPacket(aPacket, len);
+
+  if (++statsZone == eProfileCount) //All sent
+  {
+    statsZone = 0xFF;
+    if (statsReset)
+      ProfileReset();
+  }
+}
+
+//Sends next packet of the dump, if bulk output has room for it
+void SMFUpdate()
+{
+  byte aPacket[SMF_PACKET];
+  byte len = 7;
+  byte i, b;
+
+  if (resultCount) //Results first : sent before the packets of a next transfer
+  {
+    SMFSendResults();
+    return;
+  }
+  if (statsZone != 0xFF) //Stats first : short
+  {
+    SMFSendStats();
+    return;
+  }
+  if (writePhase == eSMFWriteIdle)
+    return;
+  if (LooperChanges() != writer.changes) //Slots changed while dumping
+  {
+    writePhase = eSMFWriteIdle;
+    SMFSendResult(writer.slot, 1);
+    return;
+  }
+  if (writer.counting)
+  {
+    SMFWriteCount();
+    return;
+  }
+  if (MIDIOutFree(eMIDIOutBulk) < (SMF_PACKET + 2) / 3)
+    return;
+
+  aPacket[0] = 0xF0;
+  aPacket[1] = SMF_SYSEX_ID;
+  aPacket[2] = SMF_SYSEX_DEV;
+  aPacket[3] = SMF_CMD_DATA;
+  aPacket[4] = writer.slot;
+  aPacket[5] = writer.seq;
+  aPacket[6] = 0;
+  for (i = 0; (i < SMF_GROUP) && SMFWriteByte(&b); i++)
+  {
+    aPacket[6]     |= (b >> 7) << i;
+    aPacket[len++]  = b & 0x7F;
+  }
+  if (!i) //Whole file sent
+  {
+    writePhase = eSMFWriteIdle;
+    SMFSendResult(writer.slot, 0);
+    return;
+  }
+  aPacket[len++] = 0xF7;
+  SMFSendPacket(aPacket, len);
+  writer.seq = (writer.seq + 1) & 0x7F;
+}
+
+
+// ######## FILE PARSING #########
+//File tick length from division
+void SMFReadTick()
+{
+  if (reader.division & 0x8000) //SMPTE : frames per second (negative) x ticks per frame, at current tempo
+    reader.tick = ((CLOCK_PPQN * 1000000UL / MIDIClockTempo()) << 4) / ((byte)(-(char)highByte(reader.division)) * (unsigned long)lowByte(reader.division));
+  else if (reader.division) //Ticks per quarter note
+    reader.tick = ((CLOCK_PPQN << 4) + reader.division / 2) / reader.division;
+}
+
+void SMFReadFail()
+{
+  readPhase = eSMFReadError;
+  LooperSlotClear(reader.slot);
+  SMFSendResult(reader.slot, 1);
+}
+
+//End of track : loop length is its duration, notes still sounding end with the loop
+void SMFReadTrackEnd()
+{
+  unsigned long delay = reader.time - reader.lastOn;
+  byte i;
+
+  if (!reader.count) //Nothing in this track (tempo map...), try next one
+  {
+    readPhase    = eSMFReadChunk;
+    reader.value    = 0;
+    reader.valuePos = 0;
+    return;
+  }
+
+  if (!delay) //Loop ends on its last note : use last interval
+    delay = reader.lastOn - reader.prevOn;
+  if (!delay)
+    delay = SMF_LAST_DELAY;
+  if (delay > 0xFFFF)
+    delay = 0xFFFF;
+  for (i = 0; i < reader.openCount; i++)
+    StoreSetDuration(reader.slot, reader.aOpen[i].handle, (unsigned int)((unsigned int)(reader.lastOn + delay) - reader.aOpen[i].time));
+  reader.openCount = 0;
+
+  readPhase = eSMFReadDone;
+  SMFSendResult(reader.slot, LooperSlotLoad(reader.slot, reader.channel, reader.count, delay) ? 0 : 1);
+}
+
+void SMFReadEvent()
+{
+  byte type = reader.running & 0xF0;
+  byte i;
+
+  if ((type != 0x80) && (type != 0x90))
+    return;
+  if ((reader.channel == 0xFF) && (type == 0x90) && reader.aData[1]) //First NoteOn decides the slot's channel
+    reader.channel = reader.running & 0x0F;
+  if ((reader.running & 0x0F) != reader.channel)
+    return;
+
+  if ((type == 0x90) && reader.aData[1]) //NoteOn
+  {
+    tNoteEvent ev;
+    unsigned int handle;
+
+    ev.time     = reader.time;
+    ev.note     = reader.aData[0];
+    ev.velocity = reader.aData[1];
+    ev.duration = 0;  //NoteOff will set duration
+    handle = (reader.count == 0xFF) ? STORE_FULL : StoreAppend(reader.slot, &ev);
+    if (handle == STORE_FULL)
+    {
+      SMFReadFail();
+      return;
+    }
+    reader.count ++;
+    reader.prevOn = reader.lastOn;
+    reader.lastOn = reader.time;
+
+    if (reader.openCount == SMF_MAX_OPEN) //Forget oldest note (remains a short note)
+    {
+      reader.openCount --;
+      memmove(&reader.aOpen[0], &reader.aOpen[1], reader.openCount*sizeof(tSMFOpen));
+    }
+    reader.aOpen[reader.openCount].note   = ev.note;
+    reader.aOpen[reader.openCount].handle = handle;
+    reader.aOpen[reader.openCount].time   = reader.time;
+    reader.openCount ++;
+    return;
+  }
+
+  for (i = reader.openCount; i > 0; i--) //NoteOff : set duration of its NoteOn
+  {
+    if (reader.aOpen[i-1].note == reader.aData[0])
+    {
+      StoreSetDuration(reader.slot, reader.aOpen[i-1].handle, (unsigned int)((unsigned int)reader.time - reader.aOpen[i-1].time));
+      reader.openCount --;
+      memmove(&reader.aOpen[i-1], &reader.aOpen[i], (reader.openCount - (i-1))*sizeof(tSMFOpen));
+      return;
+    }
+  }
+}
+
+void SMFReadMetaEnd()
+{
+  readPhase = eSMFReadDelta;
+  if (reader.meta == 0x2F) //End of Track
+    SMFReadTrackEnd();
+  reader.value = 0;
+}
+
+//Parses next byte of the file
+void SMFReadByte(byte b)
+{
+  unsigned long t;
+
+  if (readPhase >= eSMFReadDelta)
+    reader.left --;
+
+  switch (readPhase)
+  {
+    case eSMFReadChunk:
+      reader.value = (reader.value << 8) | b;
+      if (++reader.valuePos == 4)
+      {
+        reader.chunk = reader.value;
+        reader.value = 0;
+        break;
+      }
+      if (reader.valuePos < 8)
+        break;
+      reader.left     = reader.value;
+      reader.value    = 0;
+      reader.valuePos = 0;
+      reader.running  = 0;
+      reader.time     = 0;
+      reader.remain   = 8;    //Round times to nearest tick
+      if (reader.chunk == SMF_MTHD)
+      {
+        reader.division = 0;
+        readPhase    = eSMFReadHeader;
+      }
+      else if (reader.chunk == SMF_MTRK)
+        readPhase = eSMFReadDelta;
+      else
+        readPhase = eSMFReadSkip;
+      if (!reader.left)
+        readPhase = eSMFReadChunk;
+      return;
+    case eSMFReadHeader: //format (2), tracks (2), division (2)
+      if ((++reader.valuePos == 5) || (reader.valuePos == 6))
+        reader.division = (reader.division << 8) | b;
+      if (--reader.left)
+        return;
+      reader.valuePos = 0;
+      SMFReadTick();
+      readPhase = eSMFReadChunk;
+      return;
+    case eSMFReadSkip:
+      if (!--reader.left)
+        readPhase = eSMFReadChunk;
+      return;
+    case eSMFReadDelta:
+      reader.value = (reader.value << 7) | (b & 0x7F);
+      if (b & 0x80)
+        break;
+      t = reader.value * reader.tick + reader.remain;
+      reader.time  += t >> 4;
+      reader.remain = t & 0x0F;
+      reader.value  = 0;
+      readPhase  = eSMFReadStatus;
+    break;
+    case eSMFReadStatus:
+      reader.dataPos = 0;
+      if (b == 0xFF)
+      {
+        readPhase = eSMFReadMetaType;
+        break;
+      }
+      if ((b == 0xF0) || (b == 0xF7))
+      {
+        reader.meta  = 0;
+        readPhase = eSMFReadLength;
+        break;
+      }
+      if (b >= 0xF0)
+      {
+        SMFReadFail();
+        return;
+      }
+      if (b & 0x80)
+      {
+        reader.running = b;
+        readPhase   = eSMFReadData;
+        break;
+      }
+      if (!reader.running)
+      {
+        SMFReadFail();
+        return;
+      }
+      //Fall through - running status, b is first data byte
+    case eSMFReadData:
+      reader.aData[reader.dataPos++] = b;
+      readPhase = eSMFReadData;
+      if (reader.dataPos < (((reader.running & 0xE0) == 0xC0) ? 1 : 2)) //Program change, channel pressure : 1 byte
+        break;
+      SMFReadEvent();
+      if (readPhase == eSMFReadData)
+        readPhase = eSMFReadDelta;
+    break;
+    case eSMFReadMetaType:
+      reader.meta  = b;
+      readPhase = eSMFReadLength;
+    break;
+    case eSMFReadLength:
+      reader.value = (reader.value << 7) | (b & 0x7F);
+      if (b & 0x80)
+        break;
+      reader.length = reader.value;
+      reader.value  = 0;
+      if (reader.length)
+        readPhase = eSMFReadMetaData;
+      else
+        SMFReadMetaEnd();
+    break;
+    case eSMFReadMetaData:
+      if (!--reader.length)
+        SMFReadMetaEnd();
+    break;
+    default:
+      return;
+  }
+
+  //Track ends without End of Track
+  if (!reader.left && (readPhase >= eSMFReadDelta) && (readPhase <= eSMFReadMetaData))
+    SMFReadTrackEnd();
+}
+
+//Starts loading a file in slot
+void SMFReadStart(byte slot)
+{
+  LooperSlotClear(slot);
+  reader.slot      = slot;
+  readPhase     = eSMFReadChunk;
+  reader.channel   = 0xFF;
+  reader.count     = 0;
+  reader.value     = 0;
+  reader.valuePos  = 0;
+  reader.division  = CLOCK_PPQN;
+  reader.lastOn    = 0;
+  reader.prevOn    = 0;
+  reader.openCount = 0;
+  SMFReadTick();
+}
+
+boolean SMFReading()
+{
+  return (readPhase != eSMFReadIdle) && (readPhase != eSMFReadDone) && (readPhase != eSMFReadError);
+}
+
+
+// ######## SYSEX PACKETS #########
+void SysExCb(tSysExEvent event, byte b)
+{
+  switch (event)
+  {
+    case eSysExStart:
+      sysexPos = 0;
+    return;
+    case eSysExData:
+    break;
+    case eSysExEnd:
+      if ((sysexPos == 4) && (sysexCmd == SMF_CMD_REQUEST) && ((writePhase != eSMFWriteIdle) || SMFReading() || !SMFWriteStart(sysexSlot)))
+        SMFSendResult(sysexSlot, 1); //Dumping or loading a file, or no loop on this slot
+      if ((sysexPos == 4) && (sysexCmd == SMF_CMD_STATS) && (statsZone == 0xFF))
+      {
+        statsZone  = 0;
+        statsReset = (sysexSlot == 1);
+      }
+      sysexPos = 0xFF;
+    return;
+    default: //Truncated packet
+      if ((sysexPos == 5) && (sysexCmd == SMF_CMD_DATA) && SMFReading())
+        SMFReadFail();
+      sysexPos = 0xFF;
+    return;
+  }
+
+  switch (sysexPos)
+  {
+    case 0xFF: //Not for us
+    return;
+    case 0:
+      sysexPos = (b == SMF_SYSEX_ID) ? 1 : 0xFF;
+    return;
+    case 1:
+      sysexPos = (b == SMF_SYSEX_DEV) ? 2 : 0xFF;
+    return;
+    case 2:
+      sysexCmd = b;
+      sysexPos = 3;
+    return;
+    case 3:
+      sysexSlot = b;
+      sysexPos  = (b < MAX_SLOTS) ? 4 : 0xFF;
+    return;
+    case 4:
+      sysexPos = 0xFF;
+      if (sysexCmd != SMF_CMD_DATA)
+        return;
+      if (!b && (writePhase != eSMFWriteIdle)) //Dumping : one transfer at a time
+      {
+        SMFSendResult(sysexSlot, 1);
+        return;
+      }
+      if (!b) //New file
+        SMFReadStart(sysexSlot);
+      else if (!SMFReading() || (sysexSlot != reader.slot))
+        return;
+      else if (b != reader.seq) //Packet lost
+      {
+        SMFReadFail();
+        return;
+      }
+      reader.seq      = (b + 1) & 0x7F;
+      reader.groupPos = 0;
+      sysexPos     = 5;
+    return;
+    default: //7-in-8 groups
+      if (!reader.groupPos)
+        reader.msb = b;
+      else if (SMFReading())
+        SMFReadByte(b | (((reader.msb >> (reader.groupPos - 1)) & 0x01) << 7));
+      if (++reader.groupPos == 8)
+        reader.groupPos = 0;
+    return;
+  }
+}
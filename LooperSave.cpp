@@ -0,0 +1,212 @@
+#include "Arduino.h"
+#include <EEPROM.h>
+#include "Looper.h"
+
+/*
+-- Slots persistence :
+EEPROM is used as a circular log of records, each record is a full image of the slots :
+  [magic][version][seq][len lo][len hi][payload (len bytes)][crc lo][crc hi]
+A new record starts on the first 16 bytes boundary after the previous one : writes are spread on the whole EEPROM.
+Magic is written last, so that an interrupted save leaves the previous record valid.
+A record never wraps over the last valid one : SaveStart refuses it if both do not fit in EEPROM together.
+At boot, the valid record (magic, version and CRC checked) with the most recent seq is loaded.
+Writes are done one byte per SaveUpdate call, only when EEPROM is ready : saving never blocks the loop.
+*/
+
+/***********************************
+ *     Save configuration
+ ***********************************/
+#define SAVE_MAGIC    0xA5
+#define SAVE_VERSION  1
+#define SAVE_ALIGN    16  //Records start on 16 bytes boundaries
+#define SAVE_HEADER   5   //magic, version, seq, len
+#define SAVE_OVERHEAD (SAVE_HEADER + 2)
+
+typedef enum
+{
+  eSaveIdle,
+  eSavePayload,
+  eSaveCrc,
+  eSaveHeader,
+  eSaveMagic
+} tSavePhase;
+
+tSavePhase   savePhase = eSaveIdle;
+tSaveSource  pfSaveSource;   //Payload provider
+unsigned int saveStart;      //Record being written
+unsigned int saveLen;        //Payload length
+unsigned int savePos;        //Bytes written in current phase
+unsigned int saveCrc;
+byte         saveSeq;        //Seq of last valid record
+unsigned int saveNext;       //Where next record starts
+unsigned int saveKept;       //Size of last valid record (SaveSize), kept until a new one is complete
+unsigned int readAddr;       //Next byte to read (SaveRead)
+
+
+unsigned int SaveCrc(unsigned int crc, byte b) //CRC-16 CCITT
+{
+  byte i;
+
+  crc ^= (unsigned int)b << 8;
+  for (i = 0; i < 8; i++)
+    crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+  return crc;
+}
+
+unsigned int SaveAddr(unsigned int addr)
+{
+  return addr % EEPROM.length();
+}
+
+byte SaveReadAt(unsigned int addr)
+{
+  return EEPROM.read(SaveAddr(addr));
+}
+
+//Writes only if needed (saves EEPROM cycles), EEPROM must be ready
+void SaveWriteAt(unsigned int addr, byte b)
+{
+  addr = SaveAddr(addr);
+  if (EEPROM.read(addr) != b)
+    EEPROM.write(addr, b);
+}
+
+//Record size, up to next record start
+unsigned int SaveSize(unsigned int len)
+{
+  return ((len + SAVE_OVERHEAD + SAVE_ALIGN - 1) / SAVE_ALIGN) * SAVE_ALIGN;
+}
+
+//Header bytes covered by CRC : version, seq, len
+unsigned int SaveHeaderCrc(byte seq, unsigned int len)
+{
+  unsigned int crc = 0xFFFF;
+
+  crc = SaveCrc(crc, SAVE_VERSION);
+  crc = SaveCrc(crc, seq);
+  crc = SaveCrc(crc, lowByte(len));
+  crc = SaveCrc(crc, highByte(len));
+  return crc;
+}
+
+//Finds most recent valid record, returns its payload length (0 if none)
+//Following SaveRead calls will return its payload
+unsigned int SaveOpen()
+{
+  unsigned int addr, i, len;
+  unsigned int found = 0;
+  boolean      valid = false;
+
+  saveSeq  = 0;
+  saveNext = 0;
+  saveKept = 0;
+  for (addr = 0; addr < EEPROM.length(); addr += SAVE_ALIGN)
+  {
+    byte seq;
+    unsigned int crc;
+
+    if ((SaveReadAt(addr) != SAVE_MAGIC) || (SaveReadAt(addr + 1) != SAVE_VERSION))
+      continue;
+    seq = SaveReadAt(addr + 2);
+    len = SaveReadAt(addr + 3) | (SaveReadAt(addr + 4) << 8);
+    if (len + SAVE_OVERHEAD > EEPROM.length())
+      continue;
+
+    crc = SaveHeaderCrc(seq, len);
+    for (i = 0; i < len; i++)
+      crc = SaveCrc(crc, SaveReadAt(addr + SAVE_HEADER + i));
+    if ((lowByte(crc) != SaveReadAt(addr + SAVE_HEADER + len)) || (highByte(crc) != SaveReadAt(addr + SAVE_HEADER + len + 1)))
+      continue;
+
+    if (valid && ((byte)(seq - saveSeq) >= 0x80)) //Older than best one
+      continue;
+    valid    = true;
+    saveSeq  = seq;
+    found    = len;
+    readAddr = addr + SAVE_HEADER;
+    saveNext = SaveAddr(addr + SaveSize(len));
+    saveKept = SaveSize(len);
+  }
+  return found;
+}
+
+byte SaveRead()
+{
+  return SaveReadAt(readAddr++);
+}
+
+//Starts writing a new record, payload bytes will be requested through source
+//Returns false if it would overwrite the last valid record (always fits up to EEPROM.length()/2 - SAVE_OVERHEAD bytes)
+boolean SaveStart(unsigned int len, tSaveSource source)
+{
+  if ((len > EEPROM.length()) || (SaveSize(len) + saveKept > EEPROM.length()))
+    return false;
+
+  pfSaveSource = source;
+  saveStart    = saveNext;
+  saveLen      = len;
+  savePos      = 0;
+  saveCrc      = SaveHeaderCrc(saveSeq + 1, len);
+  savePhase    = eSavePayload;
+  return true;
+}
+
+boolean SaveBusy()
+{
+  return (savePhase != eSaveIdle);
+}
+
+//Writes next byte if EEPROM is ready, returns true once record is complete
+boolean SaveUpdate()
+{
+  byte b;
+
+  if ((savePhase == eSaveIdle) || !eeprom_is_ready())
+    return false;
+
+  switch (savePhase)
+  {
+    case eSavePayload:
+      if (savePos == saveLen)
+      {
+        savePhase = eSaveCrc;
+        savePos   = 0;
+        return false;
+      }
+      b = pfSaveSource(savePos);
+      saveCrc = SaveCrc(saveCrc, b);
+      SaveWriteAt(saveStart + SAVE_HEADER + savePos, b);
+      savePos ++;
+    break;
+    case eSaveCrc:
+      SaveWriteAt(saveStart + SAVE_HEADER + saveLen + savePos, savePos ? highByte(saveCrc) : lowByte(saveCrc));
+      if (++savePos == 2)
+      {
+        savePhase = eSaveHeader;
+        savePos   = 1;
+      }
+    break;
+    case eSaveHeader: //version, seq, len
+      switch (savePos)
+      {
+        case 1: b = SAVE_VERSION;       break;
+        case 2: b = saveSeq + 1;        break;
+        case 3: b = lowByte(saveLen);   break;
+        default: b = highByte(saveLen); break;
+      }
+      SaveWriteAt(saveStart + savePos, b);
+      if (++savePos == SAVE_HEADER)
+        savePhase = eSaveMagic;
+    break;
+    case eSaveMagic: //Record becomes valid
+      SaveWriteAt(saveStart, SAVE_MAGIC);
+      saveSeq ++;
+      saveNext  = SaveAddr(saveStart + SaveSize(saveLen));
+      saveKept  = SaveSize(saveLen);
+      savePhase = eSaveIdle;
+      return true;
+    default:
+    break;
+  }
+  return false;
+}
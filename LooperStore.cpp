@@ -0,0 +1,402 @@
+#include "Arduino.h"
+#include "Looper.h"
+
+/*
+-- Events store :
+All slots share a pool of fixed size blocks, each slot owns a chain of blocks holding its packed events.
+Blocks are allocated on demand (O(1), from the free list) and a reset slot gives back its whole chain
+at once : no fragmentation, no data move, slot count and loop length trade off freely.
+Block layout : [next block][STORE_DATA bytes of events, continued in next block]
+Event encoding (3 bytes for chord notes, 4 bytes for most others) :
+  - note     : bit 7 set when a delta time follows, bits 0-6 note number
+  - delta    : ticks since previous event, 7 bits per byte, bit 7 set when another byte follows (omitted when 0)
+  - velocity : bits 0-6
+  - duration : quantized, see DurationEncode
+Events are read back in order through a tStoreCursor (no random access).
+Events may also be inserted (overdub) : following bytes ripple through the chain, and the delta of the next
+event is rewritten in place, padded to its previous size (a 7 bits group of 0 with bit 7 set decodes the same).
+Free blocks may also be lent whole (no link) for temporary tables, see StoreTake.
+*/
+
+/***********************************
+ *     Store configuration
+ ***********************************/
+#define STORE_BLOCKS    34   //Blocks shared by all slots (544 bytes : 100 to 130 notes), what the 2KB SRAM leaves (make -C test ram)
+#define STORE_DATA      (STORE_BLOCK - 1)
+#define STORE_EVENT_MAX 6    //Worst case event size (3 bytes delta)
+
+typedef struct
+{
+  byte          first;     //First block of chain (STORE_NONE if empty)
+  byte          last;      //Last block of chain
+  byte          fill;      //Bytes used in last block
+  unsigned int  length;    //Events size (bytes)
+  unsigned long lastTime;  //Time of last event (delta reference for next append)
+} tStoreSlot;
+
+byte         aStore[STORE_BLOCKS*STORE_BLOCK];
+byte         storeFree;       //Free blocks chain
+byte         storeFreeCount;
+tStoreSlot   aStoreSlots[MAX_SLOTS];
+
+//StoreByte sequential reads : last block read
+byte         byteSlot = STORE_NONE;
+byte         byteBlock;
+unsigned int byteBase;        //Slot position of byteBlock's first byte
+
+#define STORE_NEXT(_b) aStore[(_b)*STORE_BLOCK] //Link of block _b
+
+
+//Duration on 1 byte : 4 ticks steps up to 508, then 64 ticks steps up to 8640 (1 tick = 1ms at 125 BPM)
+byte DurationEncode(unsigned long duration)
+{
+  if (duration < 510)
+    return (duration + 2) >> 2;
+
+  duration = (duration - 512 + 32) >> 6;
+  return (duration > 127) ? 255 : 128 + duration;
+}
+
+unsigned int DurationDecode(byte q)
+{
+  if (q < 128)
+    return q << 2;
+  return 512 + ((unsigned int)(q - 128) << 6);
+}
+
+//Gives back blocks from first to last (chained) to the free list
+void StoreFreeChain(byte first, byte last)
+{
+  byte b;
+
+  for (b = first; b != last; b = STORE_NEXT(b))
+    storeFreeCount ++;
+  storeFreeCount ++;
+  STORE_NEXT(last) = storeFree;
+  storeFree = first;
+  byteSlot  = STORE_NONE; //Freed blocks may be read again through StoreByte
+}
+
+//Appends a byte to a slot (a free block must be available if last one is full)
+//Returns its position in aStore
+unsigned int StoreWrite(tStoreSlot * st, byte b)
+{
+  unsigned int i;
+
+  if ((st->first == STORE_NONE) || (st->fill == STORE_DATA)) //New block
+  {
+    byte blk = storeFree;
+
+    storeFree = STORE_NEXT(blk);
+    storeFreeCount --;
+    STORE_NEXT(blk) = STORE_NONE;
+    if (st->first == STORE_NONE)
+      st->first = blk;
+    else
+      STORE_NEXT(st->last) = blk;
+    st->last = blk;
+    st->fill = 0;
+  }
+  i = st->last*STORE_BLOCK + 1 + st->fill++;
+  aStore[i] = b;
+  st->length ++;
+  return i;
+}
+
+//Byte at cursor, cursor moves to next one
+byte * StorePtr(tStoreSlot * st, tStoreCursor * cur)
+{
+  if (cur->at == STORE_BLOCK) //End of block
+  {
+    cur->block = (cur->block == STORE_NONE) ? st->first : STORE_NEXT(cur->block);
+    cur->at = 1;
+  }
+  cur->pos ++;
+  return &aStore[cur->block*STORE_BLOCK + cur->at++];
+}
+
+byte StoreRead(tStoreSlot * st, tStoreCursor * cur)
+{
+  return *StorePtr(st, cur);
+}
+
+//Packs an event in p, delta from previous event, returns its size
+byte StoreEncode(byte * p, tNoteEvent * ev, unsigned long delta)
+{
+  byte n = 0;
+
+  p[n++] = (ev->note & 0x7F) | (delta ? 0x80 : 0x00);
+  while (delta)
+  {
+    byte b = delta & 0x7F;
+    delta >>= 7;
+    p[n++] = delta ? (b | 0x80) : b;
+  }
+  p[n++] = ev->velocity & 0x7F;
+  p[n++] = DurationEncode(ev->duration);
+  return n;
+}
+
+//Inserts n bytes at cursor position (before the byte it would read), following bytes move forward
+//Room must have been checked
+void StoreInsertBytes(tStoreSlot * st, tStoreCursor * cur, byte * p, byte n)
+{
+  byte aMove[STORE_EVENT_MAX + STORE_DATA];
+  byte carry[STORE_EVENT_MAX];
+  byte blk = cur->block, at = cur->at;
+  unsigned int length = st->length + n;
+
+  if (at == STORE_BLOCK) //Insert at start of next block
+  {
+    blk = (blk == STORE_NONE) ? st->first : STORE_NEXT(blk);
+    at = 1;
+  }
+  memcpy(carry, p, n);
+  for (;;)
+  {
+    byte end = (blk == st->last) ? 1 + st->fill : STORE_BLOCK;
+    byte len = n + (end - at);
+    byte fit = (len < STORE_BLOCK - at) ? len : STORE_BLOCK - at;
+
+    //Bytes to insert then bytes of the block, as many as the block holds, the rest moves to next block
+    memcpy(aMove, carry, n);
+    memcpy(&aMove[n], &aStore[blk*STORE_BLOCK + at], end - at);
+    memcpy(&aStore[blk*STORE_BLOCK + at], aMove, fit);
+    n = len - fit;
+    memcpy(carry, &aMove[fit], n);
+    if (blk == st->last)
+    {
+      st->fill = at - 1 + fit;
+      for (at = 0; at < n; at++) //Chain grows
+        StoreWrite(st, carry[at]);
+      break;
+    }
+    blk = STORE_NEXT(blk);
+    at  = 1;
+  }
+  st->length = length;
+  byteSlot = STORE_NONE; //Bytes moved
+}
+
+void StoreSetup()
+{
+  byte b, s;
+
+  for (b = 0; b < STORE_BLOCKS; b++)
+    STORE_NEXT(b) = b + 1;
+  STORE_NEXT(STORE_BLOCKS - 1) = STORE_NONE;
+  storeFree      = 0;
+  storeFreeCount = STORE_BLOCKS;
+  byteSlot       = STORE_NONE;
+  memset(aStoreSlots, 0x00, MAX_SLOTS*sizeof(tStoreSlot));
+  for (s = 0; s < MAX_SLOTS; s++)
+    aStoreSlots[s].first = STORE_NONE;
+}
+
+//Frees all events of a slot
+void StoreReset(byte slot)
+{
+  tStoreSlot * st = &aStoreSlots[slot];
+
+  if (st->first != STORE_NONE)
+    StoreFreeChain(st->first, st->last);
+  st->first    = STORE_NONE;
+  st->fill     = 0;
+  st->length   = 0;
+  st->lastTime = 0;
+}
+
+//Appends an event (events must be appended in time order)
+//Returns a handle on the event for StoreSetDuration, or STORE_FULL
+unsigned int StoreAppend(byte slot, tNoteEvent * ev)
+{
+  tStoreSlot * st = &aStoreSlots[slot];
+  byte room = (st->first == STORE_NONE) ? 0 : STORE_DATA - st->fill;
+  byte aEvent[STORE_EVENT_MAX];
+  byte i, n;
+
+  if ((room < STORE_EVENT_MAX) && !storeFreeCount)
+    return STORE_FULL;
+
+  n = StoreEncode(aEvent, ev, ev->time - st->lastTime);
+  for (i = 0; i < n - 1; i++)
+    StoreWrite(st, aEvent[i]);
+  st->lastTime = ev->time;
+  return StoreWrite(st, aEvent[n - 1]); //Duration byte
+}
+
+//Inserts an event in time order (after events at the same time), with its duration
+//Returns its index in slot, or STORE_FULL
+unsigned int StoreInsert(byte slot, tNoteEvent * ev)
+{
+  tStoreSlot * st = &aStoreSlots[slot];
+  byte room = (st->first == STORE_NONE) ? 0 : STORE_DATA - st->fill;
+  tStoreCursor cur, at;
+  tNoteEvent next;
+  unsigned long prev = 0, delta;
+  unsigned int index = 0;
+  byte aEvent[STORE_EVENT_MAX];
+  byte * p;
+
+  if ((room < STORE_EVENT_MAX) && !storeFreeCount)
+    return STORE_FULL;
+
+  //Find first event after ev
+  StoreRewind(&cur);
+  for (;;)
+  {
+    at = cur;
+    if (!StoreNext(slot, &cur, &next)) //Last one
+      return (StoreAppend(slot, ev) == STORE_FULL) ? STORE_FULL : index;
+    if (next.time > ev->time)
+      break;
+    prev = next.time;
+    index ++;
+  }
+
+  //Shorter delta for next event, same size : ev is inserted before it
+  cur = at;
+  StorePtr(st, &cur); //Note
+  delta = next.time - ev->time;
+  do
+  {
+    p = StorePtr(st, &cur);
+    *p = (*p & 0x80) | (delta & 0x7F);
+    delta >>= 7;
+  } while (*p & 0x80);
+
+  StoreInsertBytes(st, &at, aEvent, StoreEncode(aEvent, ev, ev->time - prev));
+  return index;
+}
+
+//Sets duration of an event once its NoteOff is received
+void StoreSetDuration(byte slot, unsigned int handle, unsigned long duration)
+{
+  aStore[handle] = DurationEncode(duration);
+}
+
+void StoreRewind(tStoreCursor * cur)
+{
+  cur->pos   = 0;
+  cur->block = STORE_NONE;
+  cur->at    = STORE_BLOCK;
+  cur->time  = 0;
+}
+
+//Decodes event at cursor and moves to next one (returns false at end of slot)
+boolean StoreNext(byte slot, tStoreCursor * cur, tNoteEvent * ev)
+{
+  tStoreSlot * st = &aStoreSlots[slot];
+  byte shift = 0;
+  byte b;
+
+  if (cur->pos >= st->length)
+    return false;
+
+  b = StoreRead(st, cur);
+  ev->note = b & 0x7F;
+  if (b & 0x80) //Delta time
+  {
+    do
+    {
+      b = StoreRead(st, cur);
+      cur->time += (unsigned long)(b & 0x7F) << shift;
+      shift += 7;
+    } while (b & 0x80);
+  }
+  ev->time     = cur->time;
+  ev->velocity = StoreRead(st, cur);
+  ev->duration = DurationDecode(StoreRead(st, cur));
+  return true;
+}
+
+//Keeps only the first count events of a slot, returns number of events kept
+byte StoreTruncate(byte slot, byte count)
+{
+  tStoreSlot * st = &aStoreSlots[slot];
+  tStoreCursor cur;
+  tNoteEvent ev;
+  byte kept = 0;
+
+  StoreRewind(&cur);
+  while ((kept < count) && StoreNext(slot, &cur, &ev))
+    kept ++;
+  if (!kept)
+  {
+    StoreReset(slot);
+    return 0;
+  }
+  if (cur.block != st->last) //Free blocks after last event
+  {
+    StoreFreeChain(STORE_NEXT(cur.block), st->last);
+    STORE_NEXT(cur.block) = STORE_NONE;
+    st->last = cur.block;
+  }
+  st->fill     = cur.at - 1;
+  st->length   = cur.pos;
+  st->lastTime = cur.time;
+  return kept;
+}
+
+//Time of last event
+unsigned long StoreLastTime(byte slot)
+{
+  return aStoreSlots[slot].lastTime;
+}
+
+//Lends a free block, outside slots (loop detection onsets, see Looper.cpp) : its STORE_BLOCK bytes are free to use
+byte StoreTake()
+{
+  byte blk = storeFree;
+
+  if (!storeFreeCount)
+    return STORE_NONE;
+  storeFree = STORE_NEXT(blk);
+  storeFreeCount --;
+  return blk;
+}
+
+void StoreGive(byte block)
+{
+  StoreFreeChain(block, block);
+}
+
+byte * StoreBlock(byte block)
+{
+  return &aStore[block*STORE_BLOCK];
+}
+
+//Raw access to packed events (slots persistence)
+unsigned int StoreLength(byte slot)
+{
+  return aStoreSlots[slot].length;
+}
+
+//Sequential reads are O(1) : last block read is kept
+byte StoreByte(byte slot, unsigned int pos)
+{
+  if ((slot != byteSlot) || (pos < byteBase))
+  {
+    byteSlot  = slot;
+    byteBlock = aStoreSlots[slot].first;
+    byteBase  = 0;
+  }
+  while (pos >= byteBase + STORE_DATA)
+  {
+    byteBlock = STORE_NEXT(byteBlock);
+    byteBase += STORE_DATA;
+  }
+  return aStore[byteBlock*STORE_BLOCK + 1 + (pos - byteBase)];
+}
+
+//Appends a packed byte, StoreTruncate must be called once slot is complete (returns false if store is full)
+boolean StorePutByte(byte slot, byte b)
+{
+  tStoreSlot * st = &aStoreSlots[slot];
+
+  if (((st->first == STORE_NONE) || (st->fill == STORE_DATA)) && !storeFreeCount)
+    return false;
+  StoreWrite(st, b);
+  return true;
+}
+
@@ -0,0 +1,165 @@
+#include "MIDIProcessor.h"
+#include "Arduino.h"
+
+/*
+-- MIDI clock :
+Loops run on transport ticks (CLOCK_PPQN per quarter note) instead of ms.
+Without incoming clock, ticks run at last known tempo (125 BPM at startup : 1 tick = 1 ms).
+Incoming clock (F8, 24 per quarter note) drives ticks through a phase locked loop :
+  - tempo : clock period is smoothed over the last clocks
+  - phase : on each clock, ticks speed is set to reach next clock position, correcting 1/4 of current error
+Ticks never jump nor go backwards : replay follows tempo changes with no cumulative error.
+Start (FA), Continue (FB) and Stop (FC) are notified through a callback.
+*/
+
+/***********************************
+ *     Clock configuration
+ ***********************************/
+#define CLOCK_DEFAULT_US  20000   //Clock period at startup (125 BPM)
+#define CLOCK_TIMEOUT_US  250000  //No clock for this long : free running, at last tempo
+#define CLOCK_SMOOTH      3       //Tempo smoothing : 1/8 of new period
+#define CLOCK_PHASE       2       //Phase correction : 1/4 of error per clock
+#define CLOCK_RELOCK      4       //Phase error (in clocks) too large to be caught up : lock again
+#define CLOCK_MIN_US      2500    //Shortest clock period (1000 BPM) : clocks stamped together (late reads) are not a tempo
+
+unsigned long clockAnchorUs;    //Position reference (micros())
+unsigned long clockAnchor;      //Ticks at clockAnchorUs
+byte          clockAnchorFrac;  //1/256 ticks at clockAnchorUs
+unsigned long clockPeriod;      //Smoothed clock period (us)
+unsigned int  clockTravel;      //Ticks to travel in clockPeriod (1/256 ticks)
+unsigned long clockLastUs;      //Last clock arrival
+unsigned long clockTarget;      //Expected position of last clock (ticks)
+boolean       clockLocked;
+boolean       clockFresh;       //Locked on last clock : no period measured yet
+
+tMIDIClockCb  pfClockCb;
+
+
+void MIDIClockSetup()
+{
+  pfClockCb       = NULL;
+  clockAnchorUs   = micros();
+  clockAnchor     = 0;
+  clockAnchorFrac = 0;
+  clockPeriod     = CLOCK_DEFAULT_US;
+  clockTravel     = CLOCK_TICKS << 8;
+  clockLocked     = false;
+}
+
+//Transport position at us : ticks returned, 1/256 ticks in *frac
+unsigned long ClockPosition(unsigned long us, byte * frac)
+{
+  long dt = us - clockAnchorUs;  //May be in the past (bytes received before last clock)
+  unsigned long adt = (dt < 0) ? -dt : dt;
+  long q;
+
+  //Split to avoid overflow, whatever the delay
+  q = (adt / clockPeriod) * clockTravel + ((adt % clockPeriod) * clockTravel) / clockPeriod;
+  q = ((dt < 0) ? -q : q) + clockAnchorFrac;
+  *frac = q & 0xFF;
+  return clockAnchor + (q >> 8);
+}
+
+//Moves position reference to us, keeping position
+void ClockAnchor(unsigned long us)
+{
+  clockAnchor   = ClockPosition(us, &clockAnchorFrac);
+  clockAnchorUs = us;
+}
+
+//Clock received (F8) at us
+void MIDIClockTick(unsigned long us)
+{
+  unsigned long pos;
+  long error;
+  byte frac;
+
+  pos = ClockPosition(us, &frac);
+  error = (long)(clockTarget + CLOCK_TICKS - pos);
+
+  if (!clockLocked || (us - clockLastUs > CLOCK_TIMEOUT_US) || (abs(error) > CLOCK_RELOCK*CLOCK_TICKS))
+  {
+    //(Re)lock : this clock is on time, tempo is kept until next one
+    clockLocked = true;
+    clockFresh  = true;
+    clockTarget = pos;
+    error = 0;
+  }
+  else
+  {
+    long delta = (long)(us - clockLastUs) - (long)clockPeriod;
+    clockPeriod += clockFresh ? delta : (delta >> CLOCK_SMOOTH);
+    clockFresh   = false;
+    if (clockPeriod < CLOCK_MIN_US)
+      clockPeriod = CLOCK_MIN_US;
+    clockTarget += CLOCK_TICKS;
+    error = error * 256 - frac; //1/256 ticks (may be negative : no shift)
+  }
+  clockLastUs = us;
+
+  //Reach next clock position in one period, catching up part of the error
+  error = ((long)CLOCK_TICKS << 8) + (error >> CLOCK_PHASE);
+  if (error < (CLOCK_TICKS << 7))
+    error = CLOCK_TICKS << 7;
+  if (error > (CLOCK_TICKS << 9))
+    error = CLOCK_TICKS << 9;
+  clockAnchor     = pos;
+  clockAnchorFrac = frac;
+  clockAnchorUs   = us;
+  clockTravel     = error;
+}
+
+//Start, Continue, Stop
+void MIDIClockTransport(byte b)
+{
+  if (!pfClockCb)
+    return;
+  switch (b)
+  {
+    case 0xFA: pfClockCb(eClockStart);    break;
+    case 0xFB: pfClockCb(eClockContinue); break;
+    case 0xFC: pfClockCb(eClockStop);     break;
+  }
+}
+
+//Transport position at a micros() time
+unsigned long MIDIClockAt(unsigned long us)
+{
+  byte frac;
+  return ClockPosition(us, &frac);
+}
+
+//Current transport position
+unsigned long MIDIClockNow()
+{
+  unsigned long us = micros();
+
+  if (clockLocked && (us - clockLastUs > CLOCK_TIMEOUT_US)) //Clock lost : free running at last tempo
+  {
+    ClockAnchor(us);
+    clockTravel = CLOCK_TICKS << 8;
+    clockLocked = false;
+  }
+  else if (!clockLocked && (us - clockAnchorUs > CLOCK_TIMEOUT_US)) //Keep reference recent
+  {
+    //On a whole number of periods : position is exact there, no 1/256 tick lost at each move
+    ClockAnchor(clockAnchorUs + ((us - clockAnchorUs) / clockPeriod) * clockPeriod);
+  }
+  return MIDIClockAt(us);
+}
+
+//Quarter note length (us)
+unsigned long MIDIClockTempo()
+{
+  return clockPeriod * (CLOCK_PPQN / CLOCK_TICKS);
+}
+
+boolean MIDIClockLocked()
+{
+  return clockLocked;
+}
+
+void MIDIRegisterClockCb(tMIDIClockCb callback)
+{
+  pfClockCb = callback;
+}
@@ -1,200 +1,436 @@
 #include "MIDIProcessor.h"
 #include "Display.h"
 #include "Arduino.h"
+#include <avr/interrupt.h>
 
 
+/***********************************
+ *     UART configuration
+ ***********************************/
+//MIDI runs on USART0 (D0/D1), driven here instead of Serial : output must be queued by priority
+#define MIDI_BAUDRATE   31250
+#define MIDI_RX_BUFFER  16  //Incoming bytes (power of 2) : 5ms of MIDI (5 times the longest task budget), bytes must be read within 65ms (16 bits stamps)
+#define MIDI_OUT_QUEUE  16  //Outgoing messages per priority (power of 2), worst cases :
+                            //  urgent : NoteOffs of all sounding loop notes at once (MAX_PENDING - MAX_SLOTS)
+                            //  normal : chords of every slot due on the same tick
+                            //  bulk   : largest SysEx packet (timing stats, 9 messages)
+#define MIDI_OUT_UNUSED 0xFF //Unused bytes of a message (never a data byte)
+//#define MIDI_THRU_REALTIME  //Echo clock and transport bytes (F8-FF) : to chain another clock follower after the looper
+
 typedef struct
 {
-  byte bStatus;        //Which command
-  byte bChannel;       //bChannel (optional)
-  byte aData[3];       //Max 3 aData bytes allowed
-  byte bBytesPending;  //How many aData bytes to read ? 
-  byte bBytesRead;     //Bytes already read
-} tMIDICommand;
-tMIDICommand stCurrent;  //Current MIDI command
-tMIDICommand stRunning; //Previous MIDI command (for running status)
-boolean bIgnoredCommand;
+  byte aData[3];  //Status + data bytes, MIDI_OUT_UNUSED after last one
+} tMIDIOutMsg;
+
+//Input ring, single producer (RX interrupt) / single consumer (MIDIProcessorUpdate)
+volatile byte          aRxBuffer[MIDI_RX_BUFFER];
+volatile unsigned int  aRxTime[MIDI_RX_BUFFER];  //Arrival time of each byte (us, low 16 bits of micros())
+volatile byte rxHead = 0;  //Written by interrupt only
+volatile byte rxTail = 0;  //Written by main loop only
+volatile unsigned int rxDropped; //Bytes lost on full input ring (interrupt)
+unsigned int  rxErrors;  //Bytes out of any message : cut messages, data bytes without status
+unsigned long rxBytes;   //Bytes read, for throughput
+
+//Output rings, one per priority (drained by UART empty interrupt)
+tMIDIOutMsg   aTxQueue[eMIDIOutCount][MIDI_OUT_QUEUE];
+byte          aTxAfter[MIDI_OUT_QUEUE]; //Urgent messages : normal queue index that must be sent first
+volatile byte aTxHead[eMIDIOutCount];  //Free running write index (main loop)
+volatile byte aTxTail[eMIDIOutCount];  //Free running read index (interrupt)
+byte          aTxHighWater[eMIDIOutCount];
+unsigned int  txDropped;
+tMIDIOutMsg   txMsg;  //Message on the wire
+byte          txLen;  //Its size
+byte          txPos;  //Next byte of txMsg to send
+boolean       txSysEx; //A bulk SysEx is on the wire : nothing but its bytes (and realtime) may be sent
+byte          txStatus; //Running status on the wire, 0 if next channel message must send its status
+
+
+//Data bytes following a status byte
+//Channel messages 8n-En : index (status >> 4) & 0x07, system common F0-F7 : index 8 + (status & 0x07)
+const byte aDataLength[16] PROGMEM =
+{
+  2, 2, 2, 2, 1, 1, 2, 0,  //NoteOff, NoteOn, AfterTouch, CtrlChange, Program, ChannelPressure, Pitch, (system)
+  0, 1, 2, 1, 0, 0, 0, 0   //SysEx, TimeCode, SongPosition, SongSelect, -, -, TuneRequest, EndSysEx
+};
+
+byte DataLength(byte status)
+{
+  return pgm_read_byte(&aDataLength[(status < 0xF0) ? ((status >> 4) & 0x07) : (0x08 | (status & 0x07))]);
+}
+
+typedef struct
+{
+  byte status;     //Current (running) status, 0 when data bytes have no status to belong to
+  byte length;     //Data bytes expected
+  byte count;      //Data bytes received
+  byte aData[2];
+  boolean running; //Next data byte starts a new message with same status (running status)
+  unsigned long timestamp; //Arrival of first byte (ticks)
+} tMIDIParser;
+tMIDIParser parser;
+boolean bSysEx;    //Inside a SysEx message
 
 tMIDINoteCb  pfNoteCb;   //Callback for NoteOn/Off commands
+tMIDISysExCb pfSysExCb;  //Callback for SysEx bytes
 
-void MIDIRead(unsigned long timestamp);
-boolean ReadStatus(byte b);
-boolean ReadData(byte b, unsigned long timestamp);
+void MIDIRead(byte b, unsigned long us);
+void ReadStatus(byte b, unsigned long timestamp);
+void ReadData(byte b, unsigned long timestamp);
 
 
 void MIDIProcessorSetup()
 {
-  Serial.begin(31250);
+  byte i;
+
   pfNoteCb = NULL;
-  memset(&stCurrent,  0x00, sizeof(tMIDICommand)); //Reset current command
-  memset(&stRunning, 0x00, sizeof(tMIDICommand)); //Reset previous command
-  bIgnoredCommand = false;
+  pfSysExCb = NULL;
+  for (i = 0; i < eMIDIOutCount; i++)
+  {
+    aTxHead[i] = 0;
+    aTxTail[i] = 0;
+    aTxHighWater[i] = 0;
+  }
+  txDropped = 0;
+  txLen = 0;
+  txPos = 0;
+  txSysEx = false;
+  txStatus = 0;
+  rxDropped = 0;
+  rxErrors = 0;
+  rxBytes = 0;
+  MIDIClockSetup();
+
+  //USART0 : 31250 bauds, 8N1, RX interrupt on (TX interrupt is enabled when something is queued)
+  UBRR0H = (byte)((F_CPU / 16 / MIDI_BAUDRATE - 1) >> 8);
+  UBRR0L = (byte)(F_CPU / 16 / MIDI_BAUDRATE - 1);
+  UCSR0A = 0;
+  UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+  UCSR0B = _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+
+  parser.status  = 0;
+  parser.count   = 0;
+  parser.running = false;
+  bSysEx = false;
+}
+
+
+void MIDIProcessorUpdate()
+{
+  unsigned long now = micros();
+
+  while (rxTail != rxHead)
+  {
+    byte b = aRxBuffer[rxTail];
+    unsigned long us = now - (unsigned int)((unsigned int)now - aRxTime[rxTail]); //Stamps are in the last 65ms
+
+    rxTail = (rxTail + 1) & (MIDI_RX_BUFFER - 1); //Slot released after read
+    rxBytes ++;
+    MIDIRead(b, us);
+  }
+}
+
+//Received bytes waiting for MIDIProcessorUpdate ?
+boolean MIDIInPending()
+{
+  return rxTail != rxHead;
 }
 
+//Incoming byte : stamp it on arrival, whatever the main loop is doing
+ISR(USART_RX_vect)
+{
+  byte b    = UDR0;
+  byte next = (rxHead + 1) & (MIDI_RX_BUFFER - 1);
+
+  if (next == rxTail) //Full, drop byte
+  {
+    if (rxDropped != 0xFFFF)
+      rxDropped ++;
+    return;
+  }
+  aRxBuffer[rxHead] = b;
+  aRxTime[rxHead]   = (unsigned int)micros();
+  rxHead = next; //Publish once stored
+}
 
-void MIDIProcessorUpdate(unsigned long timestamp)
+//Size of message taken from a queue
+byte TxLength()
 {
-  while (Serial.available())
-    MIDIRead(timestamp);
+  return (txMsg.aData[1] == MIDI_OUT_UNUSED) ? 1 : ((txMsg.aData[2] == MIDI_OUT_UNUSED) ? 2 : 3);
 }
 
+//Message taken from a queue : running status encoding
+//NoteOff with default velocity is sent as NoteOn velocity 0, to keep the same status through chords
+//Any other byte (system, realtime, SysEx chunk) ends running status : some receivers lose it after them
+//Returns first byte to send (1 : status byte is skipped)
+byte TxEncode()
+{
+  byte status = txMsg.aData[0];
 
+  txLen = TxLength();
+  if (((status & 0xF0) == 0x80) && (txLen == 3) && (txMsg.aData[2] == MIDI_RELEASE_DEFAULT))
+  {
+    status = 0x90 | (status & 0x0F);
+    txMsg.aData[0] = status;
+    txMsg.aData[2] = 0;
+  }
+  if ((status < 0x80) || (status >= 0xF0))
+  {
+    txStatus = 0;
+    return 0;
+  }
+  if (status == txStatus)
+    return 1;
+  txStatus = status;
+  return 0;
+}
 
-boolean ReadStatus(byte b)
+//UART ready for next byte : finish current message, then urgent ones first, bulk ones last
+//A bulk SysEx is sent whole (up to its F7), only realtime bytes may be inserted
+ISR(USART_UDRE_vect)
 {
-  byte bStatus;
-  byte bChannel;
-  memset(&stCurrent, 0x00, sizeof(tMIDICommand)); //Reset stCurrentrent command
-    
-  if ((b & 0xF0) == 0xF0) //System messages (F0 - FF)
+  if (txPos == txLen)
   {
-    bStatus = b;
-    bChannel = 0; //No bChannel
-    bIgnoredCommand = true;
-
-#ifdef _DEBUG
-    DisplayWriteStr("### Sys:      ###", 0, 0);
-    DisplayWriteInt(bChannel, 8, 0);
-    DisplayWriteInt(st, 12, 0);
-#endif
+    byte urgent = (byte)(aTxHead[eMIDIOutUrgent] - aTxTail[eMIDIOutUrgent]);
+    byte at = aTxTail[eMIDIOutUrgent] & (MIDI_OUT_QUEUE - 1);
+    tMIDIOutMsg * msg = &aTxQueue[eMIDIOutUrgent][at];
+
+    if (txSysEx)
+      urgent = urgent && (msg->aData[0] >= 0xF8);
+
+    if (urgent && ((byte)(aTxTail[eMIDIOutNormal] - aTxAfter[at]) < 0x80)) //Urgent and not waiting for its NoteOn
+    {
+      txMsg = *msg;
+      aTxTail[eMIDIOutUrgent] ++;
+    }
+    else if (!txSysEx && (aTxHead[eMIDIOutNormal] != aTxTail[eMIDIOutNormal]))
+    {
+      txMsg = aTxQueue[eMIDIOutNormal][aTxTail[eMIDIOutNormal] & (MIDI_OUT_QUEUE - 1)];
+      aTxTail[eMIDIOutNormal] ++;
+    }
+    else if (aTxHead[eMIDIOutBulk] != aTxTail[eMIDIOutBulk])
+    {
+      txMsg = aTxQueue[eMIDIOutBulk][aTxTail[eMIDIOutBulk] & (MIDI_OUT_QUEUE - 1)];
+      aTxTail[eMIDIOutBulk] ++;
+      txSysEx = (txMsg.aData[TxLength() - 1] != 0xF7);
+    }
+    else //Nothing left
+    {
+      txLen = 0;
+      txPos = 0;
+      UCSR0B &= ~_BV(UDRIE0);
+      return;
+    }
+    txPos = TxEncode();
   }
-  else
+  UDR0 = txMsg.aData[txPos++];
+}
+
+//Queues a MIDI message for output, never waits (returns false if queue is full)
+boolean MIDISend(tMIDIOutPriority prio, byte len, byte status, byte data1, byte data2)
+{
+  byte head  = aTxHead[prio];
+  byte depth = (byte)(head - aTxTail[prio]);
+  tMIDIOutMsg * msg;
+
+  if (depth >= MIDI_OUT_QUEUE)
   {
-    bStatus = b>>4; //Status is first 4 bits
-    bChannel = b & 0x0F;  // bChannel is next 4 bits
-    bIgnoredCommand = false;
+    txDropped ++;
+    return false;
+  }
 
-#ifdef _DEBUG
+  msg = &aTxQueue[prio][head & (MIDI_OUT_QUEUE - 1)];
+  msg->aData[0] = status;
+  msg->aData[1] = (len > 1) ? data1 : MIDI_OUT_UNUSED;
+  msg->aData[2] = (len > 2) ? data2 : MIDI_OUT_UNUSED;
 
-    DisplayWriteStr("### Sts:      ###", 0, 1);
-    DisplayWriteInt(bChannel, 8, 1);
-    DisplayWriteInt(bStatus, 12, 1);
-#endif
+  //A NoteOff must not overtake its NoteOn still waiting in normal queue
+  if (prio == eMIDIOutUrgent)
+  {
+    byte after = aTxTail[eMIDIOutNormal];
+
+    if (((status & 0xF0) == 0x80) || (((status & 0xF0) == 0x90) && !data2))
+    {
+      byte i;
+      for (i = aTxTail[eMIDIOutNormal]; i != aTxHead[eMIDIOutNormal]; i++)
+      {
+        tMIDIOutMsg * on = &aTxQueue[eMIDIOutNormal][i & (MIDI_OUT_QUEUE - 1)];
+        if ((on->aData[0] == (0x90 | (status & 0x0F))) && (on->aData[1] == data1))
+          after = i + 1;
+      }
+    }
+    aTxAfter[head & (MIDI_OUT_QUEUE - 1)] = after;
   }
-      
-  stCurrent.bStatus  = bStatus;
-  stCurrent.bChannel = bChannel;
 
-  switch (bStatus)
+  aTxHead[prio] = head + 1;
+  if (depth + 1 > aTxHighWater[prio])
+    aTxHighWater[prio] = depth + 1;
+
+  UCSR0B |= _BV(UDRIE0); //Start sending (if not already)
+  return true;
+}
+
+//Messages that can still be queued
+byte MIDIOutFree(tMIDIOutPriority prio)
+{
+  return MIDI_OUT_QUEUE - (byte)(aTxHead[prio] - aTxTail[prio]);
+}
+
+//Max queue depth reached since startup
+byte MIDIOutHighWater(tMIDIOutPriority prio)
+{
+  return aTxHighWater[prio];
+}
+
+//Messages lost because output queues were full
+unsigned int MIDIOutDropped()
+{
+  return txDropped;
+}
+
+//Bytes lost because input ring was full
+unsigned int MIDIInDropped()
+{
+  unsigned int n;
+
+  noInterrupts();
+  n = rxDropped;
+  interrupts();
+  return n;
+}
+
+//Bytes received out of any message (cut messages, data bytes without status)
+unsigned int MIDIInErrors()
+{
+  return rxErrors;
+}
+
+//Bytes received since startup
+unsigned long MIDIInBytes()
+{
+  return rxBytes;
+}
+
+
+
+//Bytes out of any message : may be a lost NoteOff
+void RxError(byte count)
+{
+  rxErrors = (rxErrors > (unsigned int)(0xFFFF - count)) ? 0xFFFF : rxErrors + count;
+}
+
+//Status byte : starts a new message
+void ReadStatus(byte b, unsigned long timestamp)
+{
+  if (parser.status && (parser.status < 0xF0) && parser.count) //Channel message cut, its data bytes are lost
+    RxError(parser.count);
+  parser.status    = b;
+  parser.length    = DataLength(b);
+  parser.count     = 0;
+  parser.running   = false;
+  parser.timestamp = timestamp;
+
+  if (b < 0xF0) //Channel message : echoed once complete
+    return;
+
+  //System common
+  if (b == 0xF0) //SysEx contents are handled by MIDIRead
   {
-    //Channel dependant messages
-    case 0x08: //Note Off : Note, Velocity
-    case 0x09: //Note On : Note, Velocity
-    case 0x0A: //AfterTouch : Note, pressure
-    case 0x0B: // Ctrl Change : Controller Number, value
-    case 0x0E: //Pitch : 14 bits val : pitch value (0X2000 centered)
-      stCurrent.bBytesPending = 2;
-    break;
-    case 0x0C: //Program Patch : Prog number
-    case 0x0D: //Channel Pressure : Pressure amount
-      stCurrent.bBytesPending = 1; //
-    break;
-        
-    //System Common
-    case 0xF0: //Begin SysEx msg
-    case 0xF1:
-    case 0xF2:
-    case 0xF3:
-    case 0xF4: //Unused
-    case 0xF5: //Unused
-    case 0xF6:
-    case 0xF7: //End SysEx msg
-      //DisplayWriteStr("Sys Co", 9, 1);
-    break;
-        
-    //System Realtime
-    case 0xF8:
-    case 0xF9: //Unused
-    case 0xFA:
-    case 0xFB:
-    case 0xFC:
-    case 0xFD: //Unused
-    case 0xFE:
-    case 0xFF:
-      //DisplayWriteStr("Sys Rtm", 9, 1);
-    break;
-    default: 
-      DisplayWriteStr("### WTF:      ###", 0,0);
-      DisplayWriteInt(bChannel, 0, 8);
-      DisplayWriteInt(bStatus, 0, 12);
-  }  
-
-  return bIgnoredCommand;
-}
-
-
-boolean ReadData(byte b, unsigned long timestamp)
+    bSysEx = true;
+    if (pfSysExCb)
+      pfSysExCb(eSysExStart, b);
+  }
+  if (!parser.length) //Complete, no running status after a system message
+    parser.status = 0;
+}
+
+//Completed channel message : callbacks, then echo
+void ReadMessage()
 {
+  byte type = parser.status & 0xF0;
   boolean silent = false;
-  int i;
-  
-  if (!stCurrent.bBytesPending) //New aData, no status Bytes : "running status" mode
+
+  if (pfNoteCb && ((type == 0x90) || (type == 0x80))) //Callback for Note On/Off
   {
-    memcpy(&stCurrent, &stRunning, sizeof(tMIDICommand)); //Current MIDI status is previous One (status byte skipped)
-    bIgnoredCommand = false;
+    silent = pfNoteCb(parser.status & 0x0F,
+                      parser.aData[0],
+                      (type == 0x90) ? parser.aData[1] : 0x00,
+                      parser.timestamp); //force velocity = 0 for note Off
   }
-  if (!stCurrent.bBytesPending) //Not waiting for anything (RealTime or unsupported..)
-    return true;
-    
-  
-  stCurrent.bBytesPending --;
-  stCurrent.aData[stCurrent.bBytesRead] = b;
-  stCurrent.bBytesRead ++; 
-
-  if (stCurrent.bBytesPending) //Wait for other data bytes  
-    return false; //Bufferize
-
-  
-  //### MIDI Command completed !
-  if (bIgnoredCommand) // All data bytes already replayed
-      return true;
-  
-  //Callbacks
-  if (pfNoteCb && ((stCurrent.bStatus == 0x09) || (stCurrent.bStatus == 0x08))) //Callback for Note On/Off
+
+  if (!silent) //Echo bufferized MIDI Command
+    MIDISend(eMIDIOutUrgent, 1 + parser.length, parser.status, parser.aData[0], parser.aData[1]);
+}
+
+//Data byte : bufferized until current message is complete
+void ReadData(byte b, unsigned long timestamp)
+{
+  if (!parser.status) //No status to belong to
   {
-      //Note Off or not On + velocity = 0 ==> false, else true
-      silent = pfNoteCb( stCurrent.bChannel, 
-                         stCurrent.aData[0], 
-                         (stCurrent.bStatus == 0x09)?stCurrent.aData[1]:0x00,
-                         timestamp);//force velocity = 0 for note Off
+    RxError(1);
+    return;
   }
-  
 
+  if (parser.running) //Running status : message starts with this byte
+  {
+    parser.running   = false;
+    parser.timestamp = timestamp;
+  }
 
-  if (!silent) //Echo bufferized MIDI Command
+  if (parser.status >= 0xF0) //System common data
   {
-    Serial.write((stCurrent.bStatus << 4) | stCurrent.bChannel);
-    for (i = 0; i < stCurrent.bBytesRead; i++)
-      Serial.write(stCurrent.aData[i]);
+    if (++parser.count == parser.length)
+      parser.status = 0;
+    return;
   }
 
-  //Ready for a new msg with same status (Running Status)
-  stRunning.bStatus       = stCurrent.bStatus;
-  stRunning.bChannel      = stCurrent.bChannel; 
-  stRunning.bBytesRead    = 0;
-  stRunning.bBytesPending = stCurrent.bBytesRead;
-  memset(&stCurrent, 0x00, sizeof(tMIDICommand)); //Reset stCurrent command
-  return false;
+  parser.aData[parser.count++] = b;
+  if (parser.count < parser.length) //Wait for other data bytes
+    return;
+
+  ReadMessage();
+  parser.count   = 0; //Ready for a new msg with same status (Running Status)
+  parser.running = true;
 }
 
-void MIDIRead(unsigned long timestamp)
-{     
-  byte passThrough = true; //Only for Unknown/dropped MIDI bytes
-  byte b = Serial.read();
+//Byte received at us (micros())
+//Only complete channel messages are echoed (see ReadMessage) : system common bytes, SysEx and bytes out of any
+//message are not passed through, nor realtime bytes unless MIDI_THRU_REALTIME is defined
+void MIDIRead(byte b, unsigned long us)
+{
+  unsigned long timestamp;
 
-  if (b & 0x80) //Status Byte
+  if (b >= 0xF8) //Realtime : may be inserted anywhere, message in progress goes on
   {
-    passThrough = ReadStatus(b);
+    if (b == 0xF8)
+      MIDIClockTick(us);
+    else
+      MIDIClockTransport(b);
+#ifdef MIDI_THRU_REALTIME
+    MIDISend(eMIDIOutUrgent, 1, b);
+#endif
+    return;
   }
-  else //aData byte
+
+  if (bSysEx) //SysEx contents
   {
-    passThrough = ReadData(b, timestamp);
+    if (!(b & 0x80))
+    {
+      if (pfSysExCb)
+        pfSysExCb(eSysExData, b);
+      return;
+    }
+    bSysEx = false; //Ended by F7 or by any other status
+    if (pfSysExCb)
+      pfSysExCb((b == 0xF7) ? eSysExEnd : eSysExAbort, b);
+    if (b == 0xF7)
+      return;
   }
-  
-  return; //FIXME : blocks everything but notes (debug)
-  
-  if (passThrough)
-    Serial.write(b); //Echo input
+
+  timestamp = MIDIClockAt(us);
+  if (b & 0x80) //Status Byte
+    ReadStatus(b, timestamp);
+  else //aData byte
+    ReadData(b, timestamp);
 }
 
 
@@ -204,3 +440,8 @@ void MIDIRegisterNoteCb(tMIDINoteCb callback)
   pfNoteCb = callback;
 }
 
+void MIDIRegisterSysExCb(tMIDISysExCb callback)
+{
+  pfSysExCb = callback;
+}
+
@@ -1,10 +1,64 @@
 #include "Arduino.h"
 
 
+//timestamp : transport position (ticks, see MIDIClock.cpp)
 typedef byte (* tMIDINoteCb) (byte channel, byte note, byte velocity, unsigned long timestamp) ;
 
+typedef enum
+{
+  eSysExStart,  //F0 received
+  eSysExData,   //Data byte
+  eSysExEnd,    //F7 received
+  eSysExAbort   //Interrupted by another status byte
+} tSysExEvent;
+
+typedef void (* tMIDISysExCb) (tSysExEvent event, byte b);
+
+typedef enum
+{
+  eClockStart,     //FA
+  eClockContinue,  //FB
+  eClockStop       //FC
+} tMIDIClockEvent;
+
+typedef void (* tMIDIClockCb) (tMIDIClockEvent event);
+
+typedef enum
+{
+  eMIDIOutUrgent = 0,  //NoteOff, live passthrough : sent first
+  eMIDIOutNormal,      //Loop notes
+  eMIDIOutBulk,        //SysEx transfers : sent when nothing else is waiting
+  eMIDIOutCount
+} tMIDIOutPriority;
+
 
 
 void MIDIProcessorSetup();
-void MIDIProcessorUpdate(unsigned long timestamp);
+void MIDIProcessorUpdate();
+boolean MIDIInPending();
 void MIDIRegisterNoteCb(tMIDINoteCb callback);
+void MIDIRegisterSysExCb(tMIDISysExCb callback);
+void MIDIRegisterClockCb(tMIDIClockCb callback);
+
+#define MIDI_RELEASE_DEFAULT 0x40 //NoteOff velocity of senders without release velocity (sent as NoteOn velocity 0)
+
+boolean      MIDISend(tMIDIOutPriority prio, byte len, byte status, byte data1 = 0, byte data2 = 0);
+byte         MIDIOutFree(tMIDIOutPriority prio);
+byte         MIDIOutHighWater(tMIDIOutPriority prio);
+unsigned int MIDIOutDropped();
+unsigned int  MIDIInDropped();
+unsigned int  MIDIInErrors();
+unsigned long MIDIInBytes();
+
+
+//Transport, slave of incoming MIDI clock (see MIDIClock.cpp)
+#define CLOCK_PPQN  480  //Ticks per quarter note
+#define CLOCK_TICKS 20   //Ticks per MIDI clock (24 per quarter note)
+
+void          MIDIClockSetup();
+void          MIDIClockTick(unsigned long us);
+void          MIDIClockTransport(byte b);
+unsigned long MIDIClockAt(unsigned long us);
+unsigned long MIDIClockNow();
+unsigned long MIDIClockTempo();
+boolean       MIDIClockLocked();
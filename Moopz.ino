@@ -4,6 +4,8 @@
 #include "Display.h"
 #include "MIDIProcessor.h"
 #include "Looper.h"
+#include "Tasks.h"
+#include "Profile.h"
 
 /*
  
@@ -38,27 +40,38 @@
 */
 
 
+//Time left before next MIDI work (us) : bytes received or loop events due
+unsigned long MIDISlack()
+{
+  if (MIDIInPending())
+    return 0;
+  return LooperSlack();
+}
 
 void setup()
 {
   DisplaySetup();
-  DisplayWriteStr("   - Moopz' -   ", 0, 0);
-  DisplayWriteStr("> Starting", 1, 0);
+  DisplayWriteStr(F("   - Moopz' -   "), 0, 0);
+  DisplayWriteStr(F("> Starting"), 1, 0);
+  DisplayFlush();
   delay(2000);
 
+  ProfileSetup();
+  TaskSetup(MIDISlack); //First : setups may defer work
   MIDIProcessorSetup();
   ControlsSetup();
   LooperSetup();
 
+  //      Task                  Priority   Period (ms)  Budget (us)  Profiling zone
+  TaskAdd(MIDIProcessorUpdate,  TASK_MIDI, 0,           200,         eProfileMIDIIn);
+  TaskAdd(LooperUpdate,         TASK_MIDI, 0,           300,         eProfileLooper);
+  TaskAdd(ControlsUpdate,       1,         5,           400,         eProfileControls);
+  TaskAdd(LooperBackground,     2,         1,           300);
+  TaskAdd(DisplayUpdate,        3,         2,           1000); //Up to 4 LCD cells
+  TaskAdd(LooperUI,             3,         20,          300);
 }
 
 void loop()
 {
-  unsigned long t = millis();
-
-  ControlsUpdate(); 
-  MIDIProcessorUpdate(t);
-  LooperUpdate();
-
-  DisplayUpdate();
+  TaskRun();
 }
@@ -0,0 +1,94 @@
+#include "Arduino.h"
+#include "Profile.h"
+#include <avr/io.h>
+
+/*
+-- Profiling :
+Timer1 runs free at F_CPU/8 (0.5us per count, 32ms before wrapping) : zones are timed far more
+precisely than with micros() (4us), for the cost of two register reads.
+Zones are the scheduler tasks given a zone (see TaskAdd), and deferred work (RefreshDisplay).
+Each zone keeps its shortest and longest run, and a histogram (4 times wider buckets).
+Lateness of loop events (transport ticks between due date and queuing for output) has its own histogram.
+Runs over a limit (zone task budget, PROFILE_LATE_MAX for lateness) are counted : playing a known song
+and reading stats gives a pass/fail check of timing on the device itself.
+When a counter is full, all counters of the zone (buckets, runs over limit) are halved : shares are kept
+whatever the run time. Stats are read on the debug inspector or over SysEx (see LooperSMF.cpp).
+*/
+
+/***********************************
+ *     Profiling configuration
+ ***********************************/
+#define PROFILE_FIRST    4  //First zone bucket : < 16us (1 << PROFILE_FIRST)
+#define PROFILE_LATE_MAX 2  //Loop events later than this (ticks) are timing regressions
+
+tProfileStats aProfile[eProfileCount];
+
+
+void ProfileSetup()
+{
+  TCCR1A = 0;
+  TCCR1B = _BV(CS11); //Normal mode, clock / 8
+  ProfileReset();
+}
+
+void ProfileReset()
+{
+  byte i;
+
+  memset(aProfile, 0x00, sizeof(aProfile));
+  for (i = 0; i < eProfileCount; i++)
+    aProfile[i].min = 0xFFFF;
+}
+
+//Adds a value to zone stats : first bucket is < (1 << first), next ones grow by (1 << shift)
+void ProfileAdd(byte zone, unsigned int value, unsigned int limit, byte first, byte shift)
+{
+  tProfileStats * p = &aProfile[zone];
+  unsigned int v = value >> first;
+  byte b = 0, i;
+
+  if (value < p->min)
+    p->min = value;
+  if (value > p->max)
+    p->max = value;
+  while (v && (b < PROFILE_BUCKETS - 1))
+  {
+    v >>= shift;
+    b ++;
+  }
+  if ((p->aBuckets[b] == 0xFFFF) || (p->over == 0xFFFF)) //Full : scale down
+  {
+    for (i = 0; i < PROFILE_BUCKETS; i++)
+      p->aBuckets[i] >>= 1;
+    p->over >>= 1;
+  }
+  p->aBuckets[b] ++;
+  if (value > limit)
+    p->over ++;
+}
+
+//Start of a zone : Timer1 count, for ProfileEnd
+unsigned int ProfileStart()
+{
+  return TCNT1;
+}
+
+unsigned int ProfileEnd(byte zone, unsigned int start, unsigned int limit)
+{
+  unsigned int us = (unsigned int)(TCNT1 - start) >> 1;
+
+  if (zone < eProfileCount)
+    ProfileAdd(zone, us, limit, PROFILE_FIRST, 2);
+  return us;
+}
+
+//Loop event queued for output late ticks after its due date
+void ProfileLate(unsigned long late)
+{
+  ProfileAdd(eProfileLate, (late > 0xFFFF) ? 0xFFFF : late, PROFILE_LATE_MAX, 0, 1);
+}
+
+tProfileStats * ProfileStats(byte zone)
+{
+  return &aProfile[zone];
+}
@@ -0,0 +1,30 @@
+#include "Arduino.h"
+
+//Timing instrumentation (see Profile.cpp)
+typedef enum
+{
+  eProfileMIDIIn = 0,  //MIDIProcessorUpdate
+  eProfileLooper,      //LooperUpdate
+  eProfileControls,    //ControlsUpdate
+  eProfileDisplay,     //Deferred drawing (RefreshDisplay)
+  eProfileLate,        //Loop events : sent vs scheduled (ticks)
+  eProfileCount
+} tProfileZone;
+
+#define PROFILE_NONE    0xFF  //Task not profiled
+#define PROFILE_BUCKETS 6
+
+typedef struct
+{
+  unsigned int min;   //us (ticks for eProfileLate)
+  unsigned int max;
+  unsigned int aBuckets[PROFILE_BUCKETS]; //Zones : < 16, < 64, < 256us, < 1, < 4ms, more. Late : 0, 1, < 4, < 8, < 16 ticks, more
+  unsigned int over;  //Runs over limit : regressions (task budget, PROFILE_LATE_MAX ticks for eProfileLate)
+} tProfileStats;
+
+void          ProfileSetup();
+void          ProfileReset();
+unsigned int  ProfileStart();
+unsigned int  ProfileEnd(byte zone, unsigned int start, unsigned int limit); //Returns run time (us)
+void          ProfileLate(unsigned long late);
+tProfileStats * ProfileStats(byte zone);
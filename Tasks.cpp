@@ -0,0 +1,140 @@
+#include "Arduino.h"
+#include "Tasks.h"
+#include "Profile.h"
+
+/*
+-- Tasks :
+Main loop work is split in tasks, each one with a period, a priority and a time budget.
+On each pass (TaskRun, called by loop()) :
+  - MIDI tasks (TASK_MIDI priority) run first, on every pass
+  - then the first due task of lower priority runs, if its budget fits before next MIDI work
+  - when none did, one deferred work (UI refresh triggered by callbacks...) runs, if no MIDI is due
+Running one low priority task per pass keeps MIDI latency close to the longest task.
+A task starved for TASK_LATE ms runs anyway (dense loops must not freeze controls).
+Every task run is timed, runs over budget are counted per task (TaskOverruns), and in zone stats for tasks
+given a zone (see Profile.cpp).
+*/
+
+/***********************************
+ *     Tasks configuration
+ ***********************************/
+#define TASK_MAX          6
+#define TASK_DEFER_MAX    4     //Deferred works waiting
+#define TASK_DEFER_BUDGET 1000  //Deferred work budget (us)
+#define TASK_LATE         50    //Max delay of a task past its period (ms)
+
+typedef struct
+{
+  tTaskFn       fn;
+  byte          priority;  //TASK_MIDI first, lower priority as value grows
+  unsigned int  period;    //Min time between two runs (ms)
+  unsigned int  budget;    //Expected run time (us)
+  unsigned int  last;      //Last run (millis(), low 16 bits : periods are short)
+  unsigned int  overruns;  //Runs over budget (saturates)
+  byte          zone;      //Profiling zone (PROFILE_NONE : no zone stats)
+} tTask;
+
+tTask        aTasks[TASK_MAX];
+byte         taskCount;
+tTaskFn      aDeferred[TASK_DEFER_MAX];
+byte         deferCount;
+tTaskSlackFn pfSlack;
+
+
+void TaskSetup(tTaskSlackFn slack)
+{
+  taskCount     = 0;
+  deferCount = 0;
+  pfSlack    = slack;
+}
+
+//Adds a task, kept sorted on priority (returns task id, or 0xFF if no room left)
+//Ids change when a task of higher priority is added after : add tasks in priority order
+byte TaskAdd(tTaskFn fn, byte priority, unsigned int period, unsigned int budget, byte zone)
+{
+  byte i;
+
+  if (taskCount == TASK_MAX)
+    return 0xFF;
+  for (i = taskCount; (i > 0) && (aTasks[i - 1].priority > priority); i--)
+    aTasks[i] = aTasks[i - 1];
+
+  aTasks[i].fn       = fn;
+  aTasks[i].priority = priority;
+  aTasks[i].period   = period;
+  aTasks[i].budget   = budget;
+  aTasks[i].last     = millis();
+  aTasks[i].overruns = 0;
+  aTasks[i].zone     = zone;
+  taskCount ++;
+  return i;
+}
+
+//Runs fn, timed in zone stats (returns true if over budget)
+boolean TaskExec(tTaskFn fn, unsigned int budget, byte zone)
+{
+  unsigned int count = ProfileStart();
+
+  fn();
+  return ProfileEnd(zone, count, budget) > budget;
+}
+
+//One scheduler pass
+void TaskRun()
+{
+  unsigned int now = millis();
+  byte i;
+
+  for (i = 0; i < taskCount; i++)
+  {
+    tTask * t = &aTasks[i];
+    unsigned int late = now - t->last;
+
+    if (late < t->period)
+      continue;
+    if ((t->priority != TASK_MIDI) && (late < t->period + TASK_LATE) && (pfSlack() < t->budget))
+      continue; //Would delay MIDI : try again on next pass
+    if (TaskExec(t->fn, t->budget, t->zone) && (t->overruns != 0xFFFF))
+      t->overruns ++;
+    t->last = now;
+    if (t->priority != TASK_MIDI)
+      return;
+  }
+
+  //Nothing else to do : run oldest deferred work
+  if (deferCount && (pfSlack() >= TASK_DEFER_BUDGET))
+  {
+    tTaskFn fn = aDeferred[0];
+
+    deferCount --;
+    memmove(&aDeferred[0], &aDeferred[1], deferCount*sizeof(tTaskFn));
+    TaskExec(fn, TASK_DEFER_BUDGET, eProfileDisplay);
+  }
+}
+
+//Runs fn later, once, when no MIDI is due (returns false if queue is full)
+//Deferring a work already waiting does nothing : several requests are done at once
+boolean TaskDefer(tTaskFn fn)
+{
+  byte i;
+
+  for (i = 0; i < deferCount; i++)
+  {
+    if (aDeferred[i] == fn)
+      return true;
+  }
+  if (deferCount == TASK_DEFER_MAX)
+    return false;
+  aDeferred[deferCount++] = fn;
+  return true;
+}
+
+byte TaskCount()
+{
+  return taskCount;
+}
+
+unsigned int TaskOverruns(byte task)
+{
+  return aTasks[task].overruns;
+}
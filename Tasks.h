@@ -0,0 +1,14 @@
+#include "Arduino.h"
+
+//Cooperative scheduler (see Tasks.cpp)
+typedef void (* tTaskFn) ();
+typedef unsigned long (* tTaskSlackFn) (); //Time left before next MIDI work (us)
+
+#define TASK_MIDI 0 //Priority of MIDI tasks : run on each pass, whatever the budgets
+
+void         TaskSetup(tTaskSlackFn slack);
+byte         TaskAdd(tTaskFn fn, byte priority, unsigned int period, unsigned int budget, byte zone = 0xFF); //period : ms, budget : us, zone : see Profile.h (0xFF : PROFILE_NONE)
+void         TaskRun();
+boolean      TaskDefer(tTaskFn fn);
+byte         TaskCount();
+unsigned int TaskOverruns(byte task); //Runs over budget of task (id from TaskAdd)
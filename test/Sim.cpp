@@ -0,0 +1,523 @@
+#include "Sim.h"
+#include <LiquidCrystal.h>
+#include <EEPROM.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+-- Simulated board :
+Host build of the firmware : Moopz.ino and the modules are compiled as is, against the Arduino layer of
+arduino/ whose registers and functions are driven from here.
+Virtual time (us) only moves between loop() passes : a pass runs at once, then costs SimPassCost us
+while interrupts due in that time run, in date order, each one at its own date.
+  - USART0 : received bytes are given to USART_RX_vect at their date (stamped on arrival, as on the device).
+    Sent bytes take SIM_BYTE_US on the wire, the data register buffers one byte : USART_UDRE_vect runs
+    as soon as it is empty, while enabled.
+  - ADC : a conversion of the selected knob completes every 1024us (Timer0 overflow trigger).
+  - Buttons read low on PIND while pressed (pull-ups).
+  - LCD : characters are written in a 16x2 screen image.
+  - EEPROM : kept across SimBoot calls, erased (0xFF) at first boot.
+  - Timer1 follows the CPU time of the host thread (0.5us counts) : profiling zones report host run time.
+Firmware globals are only set by setup() : run one boot per process (fork) for independent runs.
+*/
+
+/***********************************
+ *     Simulation configuration
+ ***********************************/
+#define SIM_ADC_US     1024  //Knob conversion period (Timer0 overflow)
+#define SIM_PASS_US    20    //Default loop() pass cost
+#define SIM_KNOBS      2
+#define SIM_NEVER      0xFFFFFFFFFFFFFFFFULL
+
+extern "C" void USART_RX_vect();
+extern "C" void USART_UDRE_vect();
+extern "C" void ADC_vect();
+void setup();
+void loop();
+
+//Registers
+tSimUDR          UDR0;
+volatile uint8_t UBRR0H, UBRR0L, UCSR0A, UCSR0B, UCSR0C;
+volatile uint8_t PIND;
+volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+volatile uint16_t ADC;
+volatile uint8_t TCCR1A, TCCR1B;
+EEPROMClass      EEPROM;
+
+unsigned long simUs;          //Virtual time
+unsigned int  simPassUs = SIM_PASS_US;
+unsigned int  simJitterUs;
+unsigned long simRandom;
+
+tSimByte *    aSimIn;         //Bytes to receive, in date order
+unsigned int  simInCount;
+unsigned int  simInSize;
+unsigned int  simInPos;       //Next byte to receive
+byte          simRxByte;      //Data register (read)
+
+tSimByte *    aSimOut;        //Bytes sent
+unsigned int  simOutCount;
+unsigned int  simOutSize;
+tSimMsg *     aSimMsgs;       //aSimOut decoded (SimMIDIOutMsgs)
+unsigned long simTxFree;      //Shift register free from this date
+boolean       simTxHold;      //Data register holds a byte waiting for the shift register
+byte          simTxByte;
+
+unsigned long simAdcNext;
+int           aSimKnobs[SIM_KNOBS];
+
+char          aSimScreen[2][17];
+byte          simLcdCol;
+byte          simLcdRow;
+
+byte          aSimEEPROM[SIM_EEPROM_SIZE];
+boolean       simEEPROMInit = false;
+
+
+unsigned long SimRandom()
+{
+  simRandom = simRandom * 1103515245UL + 12345;
+  return (simRandom >> 16) & 0x7FFF;
+}
+
+//Appends v (count items of size bytes) to a growing array
+void * SimGrow(void * array, unsigned int count, unsigned int * size, unsigned int item)
+{
+  if (count < *size)
+    return array;
+  *size = *size ? *size * 2 : 256;
+  array = realloc(array, *size * item);
+  if (!array)
+  {
+    fprintf(stderr, "Sim : out of memory\n");
+    exit(1);
+  }
+  return array;
+}
+
+void SimSend(unsigned long us, byte b)
+{
+  aSimOut = (tSimByte *)SimGrow(aSimOut, simOutCount, &simOutSize, sizeof(tSimByte));
+  aSimOut[simOutCount].us = us;
+  aSimOut[simOutCount].b  = b;
+  simOutCount ++;
+}
+
+//Runs interrupts due until given date, in date order (USART RX first on same date, as AVR priorities)
+void SimInterrupts(unsigned long until)
+{
+  while (true)
+  {
+    unsigned long tRx  = ((simInPos < simInCount) && (UCSR0B & _BV(RXCIE0))) ? aSimIn[simInPos].us : SIM_NEVER;
+    unsigned long tTx  = simTxHold ? simTxFree : ((UCSR0B & _BV(UDRIE0)) ? simUs : SIM_NEVER);
+    unsigned long tAdc = (ADCSRA & _BV(ADIE)) ? simAdcNext : SIM_NEVER;
+    unsigned long t    = min(tRx, min(tTx, tAdc));
+
+    if ((t == SIM_NEVER) || (t > until))
+      break;
+    if (t > simUs)
+      simUs = t;
+
+    if (t == tRx)
+    {
+      simRxByte = aSimIn[simInPos++].b;
+      USART_RX_vect();
+    }
+    else if ((t == tTx) && simTxHold) //Shift register takes the buffered byte
+    {
+      simTxHold = false;
+      simTxFree = simUs + SIM_BYTE_US;
+      SimSend(simTxFree, simTxByte);
+    }
+    else if (t == tTx)
+    {
+      USART_UDRE_vect();
+    }
+    else
+    {
+      ADC = aSimKnobs[(ADMUX & 0x07) % SIM_KNOBS];
+      simAdcNext += SIM_ADC_US;
+      ADC_vect();
+    }
+  }
+  if (until > simUs)
+    simUs = until;
+}
+
+tSimUDR & tSimUDR::operator = (uint8_t b)
+{
+  if (!simTxHold && (simTxFree <= simUs))
+  {
+    simTxFree = simUs + SIM_BYTE_US;
+    SimSend(simTxFree, b);
+  }
+  else
+  {
+    simTxHold = true;
+    simTxByte = b;
+  }
+  return *this;
+}
+
+tSimUDR::operator uint8_t ()
+{
+  return simRxByte;
+}
+
+
+// ######## SIMULATION CONTROL #########
+void SimBoot()
+{
+  byte i;
+
+  if (!simEEPROMInit)
+  {
+    memset(aSimEEPROM, 0xFF, sizeof(aSimEEPROM));
+    simEEPROMInit = true;
+  }
+  simUs       = 0;
+  simRandom   = 1;
+  simInCount  = 0;
+  simInPos    = 0;
+  simOutCount = 0;
+  simTxFree   = 0;
+  simTxHold   = false;
+  simAdcNext  = SIM_ADC_US;
+  UCSR0B      = 0;
+  ADCSRA      = 0;
+  PIND        = 0xFF;
+  for (i = 0; i < SIM_KNOBS; i++)
+    aSimKnobs[i] = 1023;
+  setup();
+}
+
+//Runs loop() passes until virtual time reaches until
+void SimRun(unsigned long until)
+{
+  while (simUs < until)
+  {
+    unsigned long cost = simPassUs;
+
+    if (simJitterUs)
+      cost += SimRandom() % (simJitterUs + 1);
+    loop();
+    SimInterrupts(simUs + cost);
+  }
+}
+
+unsigned long SimNow()
+{
+  return simUs;
+}
+
+void SimPassCost(unsigned int us, unsigned int jitter)
+{
+  simPassUs   = us;
+  simJitterUs = jitter;
+}
+
+//Wire is serial : a byte starting before the end of previous one is delayed, returns its date
+unsigned long SimMIDIIn(unsigned long us, byte b)
+{
+  if (simInCount && (us < aSimIn[simInCount - 1].us + SIM_BYTE_US))
+    us = aSimIn[simInCount - 1].us + SIM_BYTE_US;
+  aSimIn = (tSimByte *)SimGrow(aSimIn, simInCount, &simInSize, sizeof(tSimByte));
+  aSimIn[simInCount].us = us;
+  aSimIn[simInCount].b  = b;
+  simInCount ++;
+  return us;
+}
+
+unsigned long SimMIDIInMsg(unsigned long us, byte len, byte status, byte data1, byte data2)
+{
+  byte aData[3] = {status, data1, data2};
+  byte i;
+
+  for (i = 0; i < len; i++)
+    us = SimMIDIIn(us, aData[i]);
+  return us;
+}
+
+void SimButton(byte button, boolean pressed)
+{
+  if (pressed)
+    PIND &= ~_BV(2 + button);
+  else
+    PIND |= _BV(2 + button);
+}
+
+void SimPress(byte button, unsigned long ms)
+{
+  SimButton(button, true);
+  SimRun(simUs + ms*1000);
+  SimButton(button, false);
+  SimRun(simUs + 50000);
+}
+
+void SimKnob(byte knob, int value)
+{
+  aSimKnobs[knob] = value;
+}
+
+unsigned int SimMIDIOut(tSimByte ** bytes)
+{
+  *bytes = aSimOut;
+  return simOutCount;
+}
+
+void SimMIDIOutClear()
+{
+  simOutCount = 0;
+}
+
+//Data bytes of a status byte
+byte SimDataLength(byte status)
+{
+  static const byte aLength[16] = {2, 2, 2, 2, 1, 1, 2, 0, 0, 1, 2, 1, 0, 0, 0, 0};
+  return aLength[(status < 0xF0) ? ((status >> 4) & 0x07) : (0x08 | (status & 0x07))];
+}
+
+unsigned int SimMIDIOutMsgs(tSimMsg ** msgs)
+{
+  unsigned int i, count = 0, size = 0;
+  byte status = 0, need = 0, got = 0;
+  tSimMsg m, sysex;
+
+  sysex.len = 0;
+  free(aSimMsgs);
+  aSimMsgs = NULL;
+  for (i = 0; i < simOutCount; i++)
+  {
+    byte b = aSimOut[i].b;
+
+    m.us  = aSimOut[i].us;
+    m.len = 0;
+    if (b >= 0xF8) //Realtime
+    {
+      m.len      = 1;
+      m.aData[0] = b;
+    }
+    else if (sysex.len && !(b & 0x80))
+    {
+      if (sysex.len < 3)
+        sysex.aData[sysex.len] = b;
+      sysex.len ++;
+      continue;
+    }
+    else
+    {
+      if (sysex.len) //Ended by F7 (or cut)
+      {
+        m = sysex;
+        m.us = aSimOut[i].us;
+        sysex.len = 0;
+        if (b == 0xF7)
+          m.len ++;
+        else
+          i --;
+      }
+      else if (b == 0xF0)
+      {
+        sysex.len      = 1;
+        sysex.aData[0] = b;
+        status = 0;
+        continue;
+      }
+      else if (b & 0x80)
+      {
+        status = b;
+        need   = SimDataLength(b);
+        got    = 0;
+        if (need)
+          continue;
+        m.len      = 1;
+        m.aData[0] = b;
+        if (b >= 0xF0)
+          status = 0;
+      }
+      else if (status)
+      {
+        m.aData[++got] = b;
+        if (got < need)
+          continue;
+        m.len      = 1 + need;
+        m.aData[0] = status;
+        got        = 0;
+        if (((status & 0xF0) == 0x90) && !m.aData[2]) //NoteOff sent as NoteOn velocity 0
+        {
+          m.aData[0] = 0x80 | (status & 0x0F);
+          m.aData[2] = 0x40;
+        }
+        if (status >= 0xF0)
+          status = 0;
+      }
+      else //Data byte out of any message
+      {
+        m.len      = 1;
+        m.aData[0] = b;
+      }
+    }
+    aSimMsgs = (tSimMsg *)SimGrow(aSimMsgs, count, &size, sizeof(tSimMsg));
+    aSimMsgs[count++] = m;
+  }
+  *msgs = aSimMsgs;
+  return count;
+}
+
+const char * SimScreen(byte line)
+{
+  return aSimScreen[line];
+}
+
+int SimCompare(const void * a, const void * b)
+{
+  unsigned long va = *(const unsigned long *)a;
+  unsigned long vb = *(const unsigned long *)b;
+  return (va > vb) - (va < vb);
+}
+
+unsigned long SimPercentile(unsigned long * values, unsigned int count, byte percent)
+{
+  if (!count)
+    return 0;
+  qsort(values, count, sizeof(unsigned long), SimCompare);
+  return values[(unsigned long)(count - 1) * percent / 100];
+}
+
+
+// ######## ARDUINO CORE #########
+unsigned long millis()
+{
+  return simUs / 1000;
+}
+
+unsigned long micros()
+{
+  return simUs;
+}
+
+void delay(unsigned long ms)
+{
+  SimInterrupts(simUs + ms*1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  SimInterrupts(simUs + us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+}
+
+int digitalRead(uint8_t pin)
+{
+  return ((pin < 8) && !(PIND & _BV(pin))) ? LOW : HIGH;
+}
+
+int analogRead(uint8_t pin)
+{
+  return aSimKnobs[pin % SIM_KNOBS];
+}
+
+char * ltoa(long value, char * str, int radix)
+{
+  char * p = str;
+  unsigned long v = (value < 0) ? -(unsigned long)value : value;
+  char * q;
+
+  do
+  {
+    byte d = v % radix;
+    *p++ = (d < 10) ? '0' + d : 'a' + d - 10;
+    v /= radix;
+  } while (v);
+  if (value < 0)
+    *p++ = '-';
+  *p = 0;
+  for (q = str, p--; q < p; q++, p--) //Most significant first
+  {
+    char c = *q;
+    *q = *p;
+    *p = c;
+  }
+  return str;
+}
+
+char * itoa(int value, char * str, int radix)
+{
+  return ltoa(value, str, radix);
+}
+
+void cli()
+{
+}
+
+void sei()
+{
+}
+
+unsigned int SimTimer1()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts); //Time spent in other processes is not the firmware's
+  return (unsigned int)(ts.tv_sec * 2000000ULL + ts.tv_nsec / 500);
+}
+
+uint8_t EEPROMClass::read(int idx)
+{
+  return aSimEEPROM[idx % SIM_EEPROM_SIZE];
+}
+
+void EEPROMClass::write(int idx, uint8_t val)
+{
+  aSimEEPROM[idx % SIM_EEPROM_SIZE] = val;
+}
+
+void EEPROMClass::update(int idx, uint8_t val)
+{
+  aSimEEPROM[idx % SIM_EEPROM_SIZE] = val;
+}
+
+
+// ######## LCD #########
+LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3)
+{
+}
+
+void LiquidCrystal::begin(uint8_t cols, uint8_t rows)
+{
+  clear();
+}
+
+void LiquidCrystal::clear()
+{
+  memset(aSimScreen, ' ', sizeof(aSimScreen));
+  aSimScreen[0][16] = 0;
+  aSimScreen[1][16] = 0;
+  simLcdCol = 0;
+  simLcdRow = 0;
+}
+
+void LiquidCrystal::setCursor(uint8_t col, uint8_t row)
+{
+  simLcdCol = col;
+  simLcdRow = row & 0x01;
+}
+
+void LiquidCrystal::createChar(uint8_t location, uint8_t charmap[])
+{
+}
+
+size_t LiquidCrystal::write(uint8_t value)
+{
+  if (simLcdCol < 16)
+    aSimScreen[simLcdRow][simLcdCol] = (value < 8) ? '0' + value : ((value == 0xFF) ? '#' : value);
+  simLcdCol ++;
+  return 1;
+}
@@ -0,0 +1,41 @@
+#include "Arduino.h"
+
+//Simulated board for the host build (see Sim.cpp)
+
+#define SIM_BYTE_US 320  //MIDI byte on the wire : 10 bits at 31250 bauds
+
+//Byte on the MIDI wire (us : end of its stop bit)
+typedef struct
+{
+  unsigned long us;
+  byte          b;
+} tSimByte;
+
+//Decoded MIDI message (running status expanded, NoteOn velocity 0 shown as NoteOff velocity 0x40)
+//SysEx messages keep their first 3 bytes
+typedef struct
+{
+  unsigned long us;    //End of last byte
+  unsigned int  len;
+  byte          aData[3];
+} tSimMsg;
+
+void          SimBoot();                                       //Power on : setup()
+void          SimRun(unsigned long until);                     //Runs loop() until virtual time (us)
+unsigned long SimNow();
+void          SimPassCost(unsigned int us, unsigned int jitter); //Virtual time of a loop() pass : us + random(jitter)
+
+//Input bytes, in date order : us is the end of stop bit, delayed while the wire is busy (returns actual date)
+unsigned long SimMIDIIn(unsigned long us, byte b);
+unsigned long SimMIDIInMsg(unsigned long us, byte len, byte status, byte data1 = 0, byte data2 = 0); //Date of last byte
+void SimButton(byte button, boolean pressed);                   //Buttons 0-2 (D2-D4)
+void SimPress(byte button, unsigned long ms);                   //Holds a button for ms, then runs 50ms after release
+void SimKnob(byte knob, int value);                             //Knobs 0-1 (A0-A1), 0-1023
+
+unsigned int SimMIDIOut(tSimByte ** bytes);                     //Bytes sent since last SimMIDIOutClear
+unsigned int SimMIDIOutMsgs(tSimMsg ** msgs);                   //Same, decoded
+void         SimMIDIOutClear();
+const char * SimScreen(byte line);                              //LCD contents (custom chars 0-7 shown as '0'-'7')
+
+//Percentiles of a set of values (sorted in place)
+unsigned long SimPercentile(unsigned long * values, unsigned int count, byte percent);
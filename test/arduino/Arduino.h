@@ -0,0 +1,52 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+//Host stand-in of the Arduino core, for the host build (see ../Sim.cpp)
+//Same names as the core, driven by the simulation : virtual time, scripted pins
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+#define HIGH         1
+#define LOW          0
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define lowByte(w)  ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+
+#define noInterrupts() cli()
+#define interrupts()   sei()
+
+//Strings in flash (WString.h)
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int  digitalRead(uint8_t pin);
+int  analogRead(uint8_t pin);
+
+char * itoa(int value, char * str, int radix);
+char * ltoa(long value, char * str, int radix);
+
+#endif
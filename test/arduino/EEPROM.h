@@ -0,0 +1,19 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+//Simulated EEPROM (see ../Sim.cpp), kept across SimBoot calls as on the device
+#include <avr/eeprom.h>
+#include <stdint.h>
+
+#define SIM_EEPROM_SIZE 1024  //ATmega328P
+
+struct EEPROMClass
+{
+  uint8_t  read(int idx);
+  void     write(int idx, uint8_t val);
+  void     update(int idx, uint8_t val);
+  uint16_t length() { return SIM_EEPROM_SIZE; }
+};
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef LiquidCrystal_h
+#define LiquidCrystal_h
+
+//Recording LCD for the host build : characters written are kept in a screen image (see ../Sim.cpp)
+//Data members are the ones of the Arduino library, so that RAM accounting (../ramsize.py) sees its real size
+#include <stdint.h>
+#include <stddef.h>
+
+class Print
+{
+  int write_error;
+public:
+  virtual size_t write(uint8_t) = 0;
+};
+
+class LiquidCrystal : public Print
+{
+public:
+  LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
+
+  void begin(uint8_t cols, uint8_t rows);
+  void clear();
+  void setCursor(uint8_t col, uint8_t row);
+  void createChar(uint8_t location, uint8_t charmap[]);
+  virtual size_t write(uint8_t value);
+
+private:
+  uint8_t _rs_pin;
+  uint8_t _rw_pin;
+  uint8_t _enable_pin;
+  uint8_t _data_pins[8];
+  uint8_t _displayfunction;
+  uint8_t _displaycontrol;
+  uint8_t _displaymode;
+  uint8_t _initialized;
+  uint8_t _numlines;
+  uint8_t _row_offsets[4];
+};
+
+#endif
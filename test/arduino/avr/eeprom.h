@@ -0,0 +1,7 @@
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+//EEPROM writes complete at once on the host
+#define eeprom_is_ready() 1
+
+#endif
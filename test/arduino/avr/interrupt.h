@@ -0,0 +1,10 @@
+#ifndef _AVR_INTERRUPT_H_
+#define _AVR_INTERRUPT_H_
+
+//Interrupt handlers are plain functions, called by the simulation when their event is due
+#define ISR(vector) extern "C" void vector(void)
+
+void cli();
+void sei();
+
+#endif
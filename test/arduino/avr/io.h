@@ -0,0 +1,48 @@
+#ifndef _AVR_IO_H_
+#define _AVR_IO_H_
+
+//ATmega328P registers used by the firmware, for the host build (see ../../Sim.cpp)
+#include <stdint.h>
+
+//USART0 data register : writes go on the simulated wire, reads return the received byte
+struct tSimUDR
+{
+  tSimUDR & operator = (uint8_t b);
+  operator uint8_t ();
+};
+extern tSimUDR UDR0;
+
+extern volatile uint8_t UBRR0H, UBRR0L, UCSR0A, UCSR0B, UCSR0C;
+extern volatile uint8_t PIND;
+extern volatile uint8_t ADMUX, ADCSRA, ADCSRB, DIDR0;
+extern volatile uint16_t ADC;
+extern volatile uint8_t TCCR1A, TCCR1B;
+
+//Timer1 (0.5us counts) follows the host clock : profiling zones measure host run time
+unsigned int SimTimer1();
+#define TCNT1 SimTimer1()
+
+#define _BV(bit) (1 << (bit))
+
+//UCSR0B
+#define RXCIE0 7
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+//UCSR0C
+#define UCSZ01 2
+#define UCSZ00 1
+//ADMUX, ADCSRA, ADCSRB
+#define REFS0  6
+#define ADEN   7
+#define ADSC   6
+#define ADATE  5
+#define ADIE   3
+#define ADPS2  2
+#define ADPS1  1
+#define ADPS0  0
+#define ADTS2  2
+//TCCR1B
+#define CS11   1
+
+#endif
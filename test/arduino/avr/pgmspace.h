@@ -0,0 +1,21 @@
+#ifndef __PGMSPACE_H_
+#define __PGMSPACE_H_
+
+//Flash is plain memory on the host
+//RAMSIZE (see ../../ramsize.py) tags flash data, so that it is not counted as RAM
+#include <stdint.h>
+#include <string.h>
+
+#ifdef RAMSIZE
+#define PROGMEM __attribute__((annotate("progmem")))
+#define PSTR(s) (__extension__({static const char __c[] PROGMEM = (s); &__c[0];}))
+#else
+#define PROGMEM
+#define PSTR(s) (s)
+#endif
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_ptr(addr)  (*(const void * const *)(addr))
+
+#endif
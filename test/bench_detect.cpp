@@ -0,0 +1,272 @@
+#include "Sim.h"
+#include "Looper.h"
+#include "MIDIProcessor.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+/*
+-- Loop detection benchmark :
+Each phrase of the corpus is played on slot 1, in Auto mode, right after a record press : 3 times in a row,
+with a little human timing jitter. A phrase is detected when the slot ends up holding exactly its notes (in any
+order within chords), with its length (within DETECT_TOLERANCE), once played twice. A phrase starting with a
+repeated motif ("A B A B A C") must be looped whole, not on that motif.
+Reports, for each phrase : notes played until detection, and host time spent in NoteCb per recorded note
+(the detector runs there). Host time only compares runs on the same machine : the AVR is ~100 times slower.
+Fails when a phrase is not detected.
+*/
+
+#define DETECT_ROUNDS    3       //Repetitions played
+#define DETECT_JITTER    6       //Max timing error of each note (ms)
+#define DETECT_TOLERANCE 20      //Loop length error allowed (ms, 1 tick = 1ms at 125 BPM)
+#define DETECT_MAX_NOTES 24
+
+typedef struct
+{
+  byte         note;
+  unsigned int at;   //ms from phrase start (same at : chord)
+  unsigned int len;  //ms
+} tPhraseNote;
+
+typedef struct
+{
+  const char * name;
+  unsigned int length; //ms
+  byte         count;
+  tPhraseNote  aNotes[DETECT_MAX_NOTES];
+} tPhrase;
+
+//Quarter note : 480ms
+const tPhrase aCorpus[] =
+{
+  {"quarters C D E F", 1920, 4, {{60, 0, 400}, {62, 480, 400}, {64, 960, 400}, {65, 1440, 400}}},
+  {"A B C A B D", 1440, 6, {{57, 0, 200}, {59, 240, 200}, {60, 480, 200}, {57, 720, 200}, {59, 960, 200}, {62, 1200, 200}}},
+  {"A B A B A C", 1440, 6, {{57, 0, 200}, {59, 240, 200}, {57, 480, 200}, {59, 720, 200}, {57, 960, 200}, {60, 1200, 200}}},
+  {"A A A B", 960, 4, {{57, 0, 100}, {57, 240, 100}, {57, 480, 100}, {59, 720, 100}}},
+  {"bass riff", 1920, 8, {{40, 0, 200}, {40, 240, 100}, {43, 480, 200}, {40, 720, 100},
+                          {45, 960, 400}, {43, 1440, 100}, {40, 1560, 100}, {38, 1680, 200}}},
+  {"same note, rhythm", 1920, 5, {{57, 0, 300}, {57, 360, 100}, {57, 480, 400}, {57, 960, 200}, {60, 1440, 400}}},
+  {"arpeggio", 1440, 6, {{48, 0, 200}, {52, 240, 200}, {55, 480, 200}, {60, 720, 200}, {55, 960, 200}, {52, 1200, 200}}},
+  {"triads", 3840, 12, {{60, 0, 900}, {64, 0, 900}, {67, 0, 900}, {57, 960, 900}, {60, 960, 900}, {64, 960, 900},
+                        {53, 1920, 900}, {57, 1920, 900}, {60, 1920, 900}, {55, 2880, 900}, {59, 2880, 900}, {62, 2880, 900}}},
+  {"bass + chords", 1920, 9, {{36, 0, 400}, {60, 480, 200}, {64, 480, 200}, {43, 960, 400}, {59, 1440, 200}, {62, 1440, 200},
+                              {41, 1680, 100}, {60, 1800, 100}, {65, 1800, 100}}},
+  {"16ths funk", 1920, 16, {{40, 0, 80}, {52, 120, 60}, {40, 240, 80}, {40, 360, 60}, {43, 480, 80}, {52, 600, 60},
+                            {45, 720, 80}, {40, 840, 60}, {40, 960, 80}, {52, 1080, 60}, {40, 1200, 80}, {47, 1320, 60},
+                            {45, 1440, 80}, {43, 1560, 60}, {40, 1680, 80}, {38, 1800, 60}}},
+  {"melody", 2880, 10, {{64, 0, 400}, {62, 480, 200}, {60, 720, 200}, {62, 960, 400}, {64, 1440, 200},
+                        {64, 1680, 200}, {64, 1920, 400}, {62, 2400, 100}, {62, 2520, 100}, {60, 2640, 200}}},
+};
+
+#define DETECT_PHRASES (sizeof(aCorpus)/sizeof(aCorpus[0]))
+
+//Results of one phrase (written by its child process)
+typedef struct
+{
+  boolean       detected;
+  boolean       sameNotes;    //Kept notes are the phrase notes
+  unsigned int  notesPlayed;  //NoteOns played until detection
+  byte          sampleSize;
+  long          lengthError;  //ms
+  unsigned long noteNs;       //Host time in NoteCb per recorded NoteOn (mean)
+  unsigned long noteMaxNs;
+} tDetectResult;
+
+tDetectResult * aDetectResults;
+
+//NoteCb timing
+byte NoteCb(byte channel, byte note, byte velocity, unsigned long timestamp);
+unsigned long long detectNs;
+unsigned long      detectMaxNs;
+unsigned int       detectNotes;
+boolean            detectTiming;
+
+unsigned long long DetectClock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+byte DetectNoteCb(byte channel, byte note, byte velocity, unsigned long timestamp)
+{
+  unsigned long long start = DetectClock();
+  byte silent = NoteCb(channel, note, velocity, timestamp);
+  unsigned long ns = DetectClock() - start;
+
+  if (detectTiming && velocity)
+  {
+    detectNs += ns;
+    detectNotes ++;
+    if (ns > detectMaxNs)
+      detectMaxNs = ns;
+  }
+  return silent;
+}
+
+unsigned long detectRandom = 12345;
+
+long DetectJitter()
+{
+  detectRandom = detectRandom * 1103515245UL + 12345;
+  return (long)((detectRandom >> 16) % (2*DETECT_JITTER + 1)) - DETECT_JITTER;
+}
+
+//Phrase events, in date order
+typedef struct
+{
+  unsigned long us;
+  byte          status;
+  byte          note;
+} tDetectEvent;
+
+int DetectCompare(const void * a, const void * b)
+{
+  const tDetectEvent * ea = (const tDetectEvent *)a;
+  const tDetectEvent * eb = (const tDetectEvent *)b;
+
+  if (ea->us != eb->us)
+    return (ea->us > eb->us) - (ea->us < eb->us);
+  return (ea->status > eb->status) - (ea->status < eb->status); //NoteOff first
+}
+
+int DetectNoteCompare(const void * a, const void * b)
+{
+  return *(const byte *)a - *(const byte *)b;
+}
+
+//Are the notes kept on slot 1 the phrase notes ? (sorted : chords notes are kept in arrival order)
+boolean DetectSameNotes(const tPhrase * phrase, byte size)
+{
+  byte aKept[DETECT_MAX_NOTES], aPlayed[DETECT_MAX_NOTES];
+  tStoreCursor cur;
+  tNoteEvent ev;
+  byte i;
+
+  if (size != phrase->count)
+    return false;
+  StoreRewind(&cur);
+  for (i = 0; i < size; i++)
+  {
+    if (!StoreNext(0, &cur, &ev))
+      return false;
+    aKept[i]   = ev.note;
+    aPlayed[i] = phrase->aNotes[i].note;
+  }
+  qsort(aKept, size, 1, DetectNoteCompare);
+  qsort(aPlayed, size, 1, DetectNoteCompare);
+  return !memcmp(aKept, aPlayed, size);
+}
+
+void DetectRun(const tPhrase * phrase, tDetectResult * r)
+{
+  tDetectEvent aEvents[2*DETECT_ROUNDS*DETECT_MAX_NOTES];
+  unsigned long t0, at = 0;
+  unsigned int count = 0, i;
+  byte round, channel, size;
+  unsigned int delay;
+  long jitter = 0;
+
+  SimBoot();
+  MIDIRegisterNoteCb(DetectNoteCb);
+  SimRun(SimNow() + 100000);
+  SimPress(1, 1200); //Record slot 1
+
+  //Same jitter for notes of a chord
+  t0 = SimNow() + 20000;
+  for (round = 0; round < DETECT_ROUNDS; round++)
+  {
+    for (i = 0; i < phrase->count; i++)
+    {
+      const tPhraseNote * n = &phrase->aNotes[i];
+
+      if (!i || (n->at != phrase->aNotes[i-1].at))
+        jitter = DetectJitter();
+      at = t0 + (round*(unsigned long)phrase->length + n->at + jitter)*1000;
+      aEvents[count].us     = at;
+      aEvents[count].status = 0x90;
+      aEvents[count].note   = n->note;
+      count ++;
+      aEvents[count].us     = at + n->len*1000;
+      aEvents[count].status = 0x80;
+      aEvents[count].note   = n->note;
+      count ++;
+    }
+  }
+  qsort(aEvents, count, sizeof(tDetectEvent), DetectCompare);
+  for (i = 0; i < count; i++)
+    aEvents[i].us = SimMIDIInMsg(aEvents[i].us, 3, aEvents[i].status, aEvents[i].note, (aEvents[i].status == 0x90) ? 100 : 0x40);
+
+  //Detection is checked once each NoteOn has been handled
+  detectTiming = true;
+  for (i = 0; i < count; i++)
+  {
+    if (aEvents[i].status != 0x90)
+      continue;
+    SimRun(aEvents[i].us + 2000);
+    if (!detectTiming)
+      continue;
+    r->notesPlayed ++;
+    if (LooperSlotInfo(0, &channel, &size, &delay))
+      detectTiming = false;
+  }
+  SimRun(t0 + (DETECT_ROUNDS*(unsigned long)phrase->length + 500)*1000);
+
+  r->detected = LooperSlotInfo(0, &channel, &size, &delay);
+  if (r->detected)
+  {
+    r->sampleSize  = size;
+    r->lengthError = (long)(StoreLastTime(0) + delay) - (long)phrase->length;
+    r->sameNotes   = DetectSameNotes(phrase, size);
+    r->detected    = r->sameNotes && (labs(r->lengthError) <= DETECT_TOLERANCE);
+  }
+  else
+    r->sampleSize = 0;
+  r->noteNs    = detectNotes ? detectNs / detectNotes : 0;
+  r->noteMaxNs = detectMaxNs;
+}
+
+int main()
+{
+  unsigned int i, detected = 0;
+  unsigned long long ns = 0;
+  unsigned long maxNs = 0;
+
+  aDetectResults = (tDetectResult *)mmap(NULL, DETECT_PHRASES*sizeof(tDetectResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  memset(aDetectResults, 0x00, DETECT_PHRASES*sizeof(tDetectResult));
+
+  printf("Loop detection : %u phrases, %d rounds each, +-%dms jitter\n", (unsigned int)DETECT_PHRASES, DETECT_ROUNDS, DETECT_JITTER);
+  for (i = 0; i < DETECT_PHRASES; i++)
+  {
+    const tPhrase * phrase = &aCorpus[i];
+    tDetectResult * r = &aDetectResults[i];
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork(); //Fresh firmware state for each phrase
+    if (!pid)
+    {
+      DetectRun(phrase, r);
+      return 0;
+    }
+    waitpid(pid, NULL, 0);
+
+    printf("  %-18s %2u notes  ", phrase->name, phrase->count);
+    if (r->detected)
+      printf("kept %2u after %2u notes (2 rounds : %2u), length %+4ldms", r->sampleSize, r->notesPlayed, 2*phrase->count, r->lengthError);
+    else if (r->sampleSize)
+      printf("WRONG LOOP : kept %2u%s, length %+6ldms          ", r->sampleSize, r->sameNotes ? "" : " (notes differ)", r->lengthError);
+    else
+      printf("NOT FOUND                                            ");
+    printf("  NoteCb %5lu ns/note (max %lu)\n", r->noteNs, r->noteMaxNs);
+    detected += r->detected;
+    ns += r->noteNs;
+    if (r->noteMaxNs > maxNs)
+      maxNs = r->noteMaxNs;
+  }
+  printf("Detected %u/%u, NoteCb %llu ns/note (max %lu), host time\n", detected, (unsigned int)DETECT_PHRASES, ns / DETECT_PHRASES, maxNs);
+  return (detected == DETECT_PHRASES) ? 0 : 1;
+}
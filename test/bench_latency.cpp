@@ -0,0 +1,179 @@
+#include "Sim.h"
+#include "Looper.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+-- Latency benchmark :
+Boots the firmware (setup()/loop() of Moopz.ino), records a loop on slot 1 (played on channel 1),
+then selects slot 2 and plays a long live trace on channel 2 : notes, chords and MIDI clock, passed through
+while the loop plays.
+Reports, for several loop() pass costs :
+  - live passthrough latency : end of input message to end of its echo on the wire
+  - loop playback jitter : loop NoteOn on the wire vs its ideal date (first one + multiple of note interval)
+Percentiles are in us, jitter is p99 - p50.
+*/
+
+#define BENCH_NOTES     2000    //Live notes
+#define BENCH_LOOP      8       //Loop notes
+#define BENCH_LOOP_US   250000  //Loop note interval
+#define BENCH_CLOCK_US  20000   //MIDI clock period (125 BPM : 1 tick = 1ms)
+
+unsigned long benchRandom = 12345;
+
+unsigned long BenchRandom(unsigned long range)
+{
+  benchRandom = benchRandom * 1103515245UL + 12345;
+  return ((benchRandom >> 16) & 0x7FFF) % range;
+}
+
+typedef struct
+{
+  unsigned long us;    //End of input message
+  byte          status;
+  byte          note;
+  boolean       matched;
+} tBenchIn;
+
+tBenchIn aIn[2*BENCH_NOTES];
+unsigned long aLatency[2*BENCH_NOTES];
+unsigned long aJitter[BENCH_NOTES];
+
+int BenchCompare(const void * a, const void * b)
+{
+  unsigned long va = ((const tBenchIn *)a)->us;
+  unsigned long vb = ((const tBenchIn *)b)->us;
+  return (va > vb) - (va < vb);
+}
+
+void BenchPrint(const char * name, unsigned long * values, unsigned int count)
+{
+  unsigned long p50 = SimPercentile(values, count, 50);
+  unsigned long p99 = SimPercentile(values, count, 99);
+
+  printf("  %-12s %5u msgs  p50 %6lu  p90 %6lu  p99 %6lu  max %6lu  jitter %6lu\n", name, count,
+         p50, SimPercentile(values, count, 90), p99, values[count - 1], p99 - p50);
+}
+
+void BenchRun(unsigned int passUs)
+{
+  unsigned long t, end, clock;
+  unsigned int i, inCount = 0, latCount = 0, jitCount = 0, count;
+  tSimMsg * msgs;
+  unsigned long firstLoop = 0;
+
+  SimPassCost(passUs, passUs / 2);
+  SimBoot();
+  SimRun(SimNow() + 100000);
+
+  //Record a loop on slot 1 : long press on button 2, then the phrase twice
+  SimPress(1, 1200);
+  t = SimNow() + 10000;
+  for (i = 0; i < 2*BENCH_LOOP + 1; i++)
+  {
+    SimMIDIInMsg(t + i*BENCH_LOOP_US, 3, 0x90, 60 + (i % BENCH_LOOP)*2, 100);
+    SimMIDIInMsg(t + i*BENCH_LOOP_US + 200000, 3, 0x80, 60 + (i % BENCH_LOOP)*2, 0x40);
+  }
+  SimRun(t + (2*BENCH_LOOP + 2)*BENCH_LOOP_US);
+
+  //Slot 2 : idle, live notes are passed through
+  SimKnob(0, 1023 - 1024/MAX_SLOTS - 1024/MAX_SLOTS/2); //Middle of slot 2 range (filtered value stops short of edges)
+  SimRun(SimNow() + 300000);
+  SimMIDIOutClear();
+
+  //Live trace : notes and chords with random gaps, clock all along (sorted, then sent on the wire)
+  t = SimNow() + 10000;
+  for (i = 0; i < BENCH_NOTES; )
+  {
+    byte chord = BenchRandom(4) ? 1 : 3;
+    unsigned long len = 50000 + BenchRandom(350000);
+    byte k;
+
+    for (k = 0; (k < chord) && (i < BENCH_NOTES); k++, i++)
+    {
+      byte note = 36 + BenchRandom(48);
+
+      aIn[inCount].us     = t;
+      aIn[inCount].status = 0x91;
+      aIn[inCount].note   = note;
+      inCount ++;
+      aIn[inCount].us     = t + len;
+      aIn[inCount].status = 0x81;
+      aIn[inCount].note   = note;
+      inCount ++;
+    }
+    t += 20000 + BenchRandom(180000);
+  }
+  end = t + 500000;
+  qsort(aIn, inCount, sizeof(tBenchIn), BenchCompare);
+  clock = SimNow() + BENCH_CLOCK_US;
+  for (i = 0; i < inCount; i++)
+  {
+    for (; clock <= aIn[i].us; clock += BENCH_CLOCK_US)
+      SimMIDIIn(clock, 0xF8);
+    aIn[i].us = SimMIDIInMsg(aIn[i].us, 3, aIn[i].status, aIn[i].note, (aIn[i].status == 0x91) ? 80 : 0x40);
+  }
+  SimRun(end);
+
+  //Match echoes with live input (first unmatched input with same status and note, sent before)
+  count = SimMIDIOutMsgs(&msgs);
+  for (i = 0; i < count; i++)
+  {
+    tSimMsg * m = &msgs[i];
+    unsigned int j;
+
+    if ((m->len != 3) || ((m->aData[0] & 0xE0) != 0x80))
+      continue;
+    if ((m->aData[0] & 0x0F) == 0) //Loop note
+    {
+      unsigned long phase;
+
+      if (m->aData[0] != 0x90)
+        continue;
+      if (!firstLoop)
+        firstLoop = m->us;
+      phase = (m->us - firstLoop) % BENCH_LOOP_US;
+      aJitter[jitCount++] = (phase > BENCH_LOOP_US / 2) ? BENCH_LOOP_US - phase : phase;
+      continue;
+    }
+    for (j = 0; j < inCount; j++)
+    {
+      tBenchIn * in = &aIn[j];
+      if (!in->matched && (in->status == m->aData[0]) && (in->note == m->aData[1]) && (in->us <= m->us))
+      {
+        in->matched = true;
+        aLatency[latCount++] = m->us - in->us;
+        break;
+      }
+    }
+  }
+
+  printf("loop() pass %u-%u us\n", passUs, passUs + passUs / 2);
+  if (latCount < inCount)
+    printf("  %u live messages lost\n", inCount - latCount);
+  BenchPrint("passthrough", aLatency, latCount);
+  BenchPrint("loop notes", aJitter, jitCount);
+}
+
+int main()
+{
+  static const unsigned int aPass[] = {20, 100, 400};
+  byte i;
+
+  printf("Latency (us) : live passthrough (input end -> echo end), loop notes (vs ideal date)\n");
+  for (i = 0; i < sizeof(aPass)/sizeof(aPass[0]); i++)
+  {
+    pid_t pid;
+
+    fflush(stdout);
+    pid = fork(); //Fresh firmware state for each run
+    if (!pid)
+    {
+      BenchRun(aPass[i]);
+      return 0;
+    }
+    waitpid(pid, NULL, 0);
+  }
+  return 0;
+}
@@ -0,0 +1,267 @@
+#include "Sim.h"
+#include "Looper.h"
+#include "MIDIProcessor.h"
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PARSER_TSC  //CPU cycles from the time stamp counter
+#endif
+
+/*
+-- MIDI parser benchmark :
+Input streams are given straight to the parser (MIDIRead, as MIDIProcessorUpdate does), in batches of
+PARSER_BATCH bytes : only parsing and its callbacks (looper NoteCb, passthrough queuing) are timed.
+Between batches, the simulated board runs for as long as the batch takes on the wire, to send the
+passthrough output. The looper is idle : every note is passed through.
+Reports bytes/s, ns/byte and cycles/byte (host time and time stamp counter, x86 only : compare runs on the same
+machine, a MIDI wire carries 3125 bytes/s), and checks that every note of the stream reached NoteCb unchanged
+(fails otherwise). Streams : clock inside running status notes, plain notes, and a performance mixing notes,
+controller floods, pitch bend sweeps, SysEx dumps and clock.
+*/
+
+#define PARSER_BYTES 200000  //Bytes per stream
+#define PARSER_BATCH 16      //Bytes parsed between two output runs
+
+void MIDIRead(byte b, unsigned long us);
+byte NoteCb(byte channel, byte note, byte velocity, unsigned long timestamp);
+
+//Notes expected by NoteCb, in order
+typedef struct
+{
+  byte channel;
+  byte note;
+  byte velocity;
+} tParserNote;
+
+byte *        aParserIn;
+unsigned int  parserInCount;
+tParserNote * aParserNotes;
+unsigned int  parserNoteCount;
+unsigned int  parserNoteRead;
+unsigned int  parserNoteErrors;
+
+unsigned long parserRandom = 12345;
+
+unsigned long ParserRandom(unsigned long range)
+{
+  parserRandom = parserRandom * 1103515245UL + 12345;
+  return ((parserRandom >> 16) & 0x7FFF) % range;
+}
+
+void ParserByte(byte b)
+{
+  if (parserInCount < PARSER_BYTES)
+    aParserIn[parserInCount++] = b;
+}
+
+void ParserNote(byte channel, byte note, byte velocity)
+{
+  aParserNotes[parserNoteCount].channel  = channel;
+  aParserNotes[parserNoteCount].note     = note;
+  aParserNotes[parserNoteCount].velocity = velocity;
+  parserNoteCount ++;
+}
+
+//Checks notes against the stream, then gives them to the looper
+byte ParserNoteCb(byte channel, byte note, byte velocity, unsigned long timestamp)
+{
+  tParserNote * n = &aParserNotes[parserNoteRead];
+
+  if ((parserNoteRead == parserNoteCount) || (n->channel != channel) || (n->note != note) || (n->velocity != velocity))
+    parserNoteErrors ++;
+  else
+    parserNoteRead ++;
+  return NoteCb(channel, note, velocity, timestamp);
+}
+
+//Notes in running status (NoteOff as NoteOn velocity 0), a clock byte (F8) after most bytes : inside messages too
+void ParserClockStream()
+{
+  byte note = 60;
+
+  ParserByte(0x90);
+  while (parserInCount < PARSER_BYTES - 8)
+  {
+    byte velocity = ParserRandom(2) ? 1 + ParserRandom(127) : 0;
+
+    if (ParserRandom(4))
+      ParserByte(0xF8);
+    ParserByte(note);
+    if (ParserRandom(4))
+      ParserByte(0xF8);
+    ParserByte(velocity);
+    ParserNote(0, note, velocity);
+    note = 36 + ParserRandom(48);
+  }
+}
+
+//Plain notes, status byte on each message
+void ParserNoteStream()
+{
+  while (parserInCount < PARSER_BYTES - 3)
+  {
+    byte channel = ParserRandom(4);
+    byte note    = 36 + ParserRandom(48);
+    byte on      = ParserRandom(2);
+
+    ParserByte((on ? 0x90 : 0x80) | channel);
+    ParserByte(note);
+    ParserByte(on ? 100 : 0x40);
+    ParserNote(channel, note, on ? 100 : 0);
+  }
+}
+
+//Performance : notes, bursts of controller (mod wheel, expression) or pitch bend moves in running status,
+//SysEx dumps for another device, clock bytes between them
+void ParserMixedStream()
+{
+  while (parserInCount < PARSER_BYTES - 8)
+  {
+    unsigned long r = ParserRandom(100);
+    byte channel = ParserRandom(2);
+    unsigned int i, count;
+
+    if (r < 50) //Chord on then off, NoteOff as NoteOn velocity 0 in running status
+    {
+      byte aChord[3], size = 1 + ParserRandom(3);
+
+      for (i = 0; i < size; i++)
+        aChord[i] = 36 + ParserRandom(48);
+      ParserByte(0x90 | channel);
+      for (i = 0; i < 2*size; i++)
+      {
+        byte velocity = (i < size) ? 1 + ParserRandom(127) : 0;
+
+        ParserByte(aChord[i % size]);
+        ParserByte(velocity);
+        ParserNote(channel, aChord[i % size], velocity);
+      }
+    }
+    else if (r < 75) //Controller flood
+    {
+      byte cc = ParserRandom(2) ? 1 : 11;
+
+      count = 16 + ParserRandom(112);
+      ParserByte(0xB0 | channel);
+      for (i = 0; i < count; i++)
+      {
+        ParserByte(cc);
+        ParserByte(i & 0x7F);
+      }
+    }
+    else if (r < 95) //Pitch bend sweep
+    {
+      count = 16 + ParserRandom(112);
+      ParserByte(0xE0 | channel);
+      for (i = 0; i < count; i++)
+      {
+        ParserByte((i * 37) & 0x7F);
+        ParserByte(0x40 + ((i * 64 / count) & 0x3F));
+      }
+    }
+    else //SysEx dump (not the looper's ID)
+    {
+      count = 32 + ParserRandom(224);
+      ParserByte(0xF0);
+      ParserByte(0x43);
+      for (i = 0; i < count; i++)
+        ParserByte(ParserRandom(0x80));
+      ParserByte(0xF7);
+    }
+    if (!ParserRandom(4))
+      ParserByte(0xF8);
+  }
+}
+
+typedef struct
+{
+  const char * name;
+  void (* fill) ();
+} tParserStream;
+
+const tParserStream aParserStreams[] =
+{
+  {"clock + running status", ParserClockStream},
+  {"notes", ParserNoteStream},
+  {"notes, CC, bend, SysEx", ParserMixedStream},
+};
+
+#define PARSER_STREAMS (sizeof(aParserStreams)/sizeof(aParserStreams[0]))
+
+unsigned long long ParserClock()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long long ParserCycles()
+{
+#ifdef PARSER_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+//Returns false if notes were lost or changed
+boolean ParserRun(const tParserStream * stream)
+{
+  unsigned long long ns = 0, cycles = 0;
+  unsigned int i, j;
+
+  aParserIn    = (byte *)malloc(PARSER_BYTES);
+  aParserNotes = (tParserNote *)malloc(PARSER_BYTES/2*sizeof(tParserNote));
+  stream->fill();
+
+  SimBoot();
+  MIDIRegisterNoteCb(ParserNoteCb);
+  SimRun(SimNow() + 100000);
+  for (i = 0; i < parserInCount; i += PARSER_BATCH)
+  {
+    unsigned long long start = ParserClock();
+    unsigned long long startCycles = ParserCycles();
+    unsigned long us = SimNow();
+
+    for (j = i; (j < i + PARSER_BATCH) && (j < parserInCount); j++)
+      MIDIRead(aParserIn[j], us);
+    cycles += ParserCycles() - startCycles;
+    ns += ParserClock() - start;
+    SimRun(us + PARSER_BATCH*SIM_BYTE_US);
+  }
+
+  printf("  %-24s %7u bytes  %9.0f bytes/s  %6.1f ns/byte  %6.1f cycles/byte  notes %u/%u", stream->name, parserInCount,
+         parserInCount * 1e9 / ns, (double)ns / parserInCount, (double)cycles / parserInCount, parserNoteRead, parserNoteCount);
+  if (parserNoteErrors || (parserNoteRead != parserNoteCount))
+  {
+    printf("  %u WRONG\n", parserNoteErrors);
+    return false;
+  }
+  printf("\n");
+  return true;
+}
+
+int main()
+{
+  unsigned int i;
+  int failed = 0;
+
+  printf("MIDI parser throughput (host time, parser and callbacks)\n");
+  for (i = 0; i < PARSER_STREAMS; i++)
+  {
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork(); //Fresh firmware state for each stream
+    if (!pid)
+      return ParserRun(&aParserStreams[i]) ? 0 : 1;
+    waitpid(pid, &status, 0);
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+  }
+  return failed;
+}
@@ -0,0 +1,9 @@
+#ifndef _STDDEF_H_
+#define _STDDEF_H_
+
+typedef unsigned int size_t;
+typedef int          ptrdiff_t;
+#define NULL 0
+#define offsetof(type, member) __builtin_offsetof(type, member)
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef _STDINT_H_
+#define _STDINT_H_
+
+//Minimal C headers for ramsize.py : AVR types (16 bits int), no system headers needed
+typedef signed char        int8_t;
+typedef unsigned char      uint8_t;
+typedef int                int16_t;
+typedef unsigned int       uint16_t;
+typedef long               int32_t;
+typedef unsigned long      uint32_t;
+typedef long long          int64_t;
+typedef unsigned long long uint64_t;
+typedef int                intptr_t;
+typedef unsigned int       uintptr_t;
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef _STDLIB_H_
+#define _STDLIB_H_
+
+#include <stddef.h>
+
+int  abs(int x);
+long labs(long x);
+
+#endif
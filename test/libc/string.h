@@ -0,0 +1,13 @@
+#ifndef _STRING_H_
+#define _STRING_H_
+
+#include <stddef.h>
+
+void * memset(void * s, int c, size_t n);
+void * memcpy(void * d, const void * s, size_t n);
+void * memmove(void * d, const void * s, size_t n);
+char * strcpy(char * d, const char * s);
+char * strcat(char * d, const char * s);
+size_t strlen(const char * s);
+
+#endif
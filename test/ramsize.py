@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+#RAM budget of the AVR build : .data + .bss of the firmware, as avr-size would report it
+#Sizes come from the AVR layout of each definition (clang, --target=avr : 16 bits int, 2 bytes pointers) :
+#  - variables with static storage (globals, static locals, anonymous unions), not in flash (PROGMEM)
+#  - string literals not in flash (F(), PSTR()), merged when identical (as the linker does)
+#  - core : millis() counters (wiring.c), LiquidCrystal vtable
+#Fails when the total leaves less than STACK_MIN bytes of the 2KB SRAM to the stack.
+#Usage : ramsize.py [-v]  (needs libclang : pip install libclang)
+import glob
+import os
+import sys
+import clang.cindex as ci
+
+SRAM      = 2048  #ATmega328P
+STACK_MIN = 256   #Stack : deepest call chain plus interrupts, about 210 bytes :
+                  #  loop, TaskRun, MIDIProcessorUpdate ... NoteCb, DubNote, StoreInsert (about 180 bytes)
+                  #  plus MIDI receive interrupt calling micros() (about 30 bytes)
+CORE      = [("wiring.c : timer0_millis, timer0_overflow_count, timer0_fract", 9),
+             ("LiquidCrystal vtable", 12)]
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+ARGS = ["-x", "c++", "--target=avr", "-mmcu=atmega328p", "-std=gnu++11", "-nostdinc",
+        "-I" + os.path.join(HERE, "libc"), "-DRAMSIZE", "-DF_CPU=16000000UL", "-I" + os.path.join(HERE, "arduino"), "-I" + ROOT,
+        "-include", "Arduino.h"]
+
+
+def InFlash(cursor):
+  return any((c.kind == ci.CursorKind.ANNOTATE_ATTR) and (c.spelling == "progmem") for c in cursor.get_children())
+
+
+def Walk(cursor, path, variables, strings, flash = False):
+  for c in cursor.get_children():
+    if (c.location.file is None) or (os.path.abspath(c.location.file.name) != path):
+      continue
+    inFlash = flash
+    if c.kind == ci.CursorKind.VAR_DECL:
+      inFlash = inFlash or InFlash(c)
+      static = (c.semantic_parent.kind != ci.CursorKind.FUNCTION_DECL) or (c.storage_class == ci.StorageClass.STATIC)
+      if static and c.is_definition() and (c.storage_class != ci.StorageClass.EXTERN) and not inFlash:
+        variables.append((c.spelling, c.type.get_size()))
+    elif (c.kind == ci.CursorKind.UNION_DECL) and c.is_anonymous() and (c.semantic_parent.kind == ci.CursorKind.TRANSLATION_UNIT):
+      variables.append(("(anonymous union) " + ", ".join(f.spelling for f in c.get_children() if f.kind == ci.CursorKind.FIELD_DECL), c.type.get_size()))
+    elif (c.kind == ci.CursorKind.STRING_LITERAL) and not flash:
+      strings.add(c.spelling)
+    Walk(c, path, variables, strings, inFlash)
+
+
+def Literal(spelling):
+  return len(bytes(spelling[1:-1], "utf-8").decode("unicode_escape")) + 1
+
+
+def main():
+  verbose = "-v" in sys.argv
+  index = ci.Index.create()
+  strings = set()
+  total = 0
+
+  files = sorted(glob.glob(os.path.join(ROOT, "*.cpp"))) + glob.glob(os.path.join(ROOT, "*.ino"))
+  for f in files:
+    tu = index.parse(f, args = ARGS)
+    errors = [d for d in tu.diagnostics if d.severity >= ci.Diagnostic.Error]
+    for d in errors:
+      print("%s" % d, file = sys.stderr)
+    if errors:
+      return 2
+    variables = []
+    Walk(tu.cursor, os.path.abspath(f), variables, strings)
+    size = sum(s for n, s in variables)
+    total += size
+    print("%-20s %5d" % (os.path.basename(f), size))
+    if verbose:
+      for n, s in sorted(variables, key = lambda v: -v[1]):
+        print("    %-24s %5d" % (n, s))
+
+  size = sum(Literal(s) for s in strings)
+  total += size
+  print("%-20s %5d  (%d strings in RAM)" % ("string literals", size, len(strings)))
+  if verbose:
+    for s in sorted(strings):
+      print("    %s" % s)
+  for name, size in CORE:
+    total += size
+    print("%-20s %5d  (%s)" % ("core", size, name))
+
+  print("RAM (.data + .bss) : %d bytes of %d, %d left for stack" % (total, SRAM, SRAM - total))
+  if SRAM - total < STACK_MIN:
+    print("Over budget : less than %d bytes left for stack" % STACK_MIN)
+    return 1
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
@@ -0,0 +1,116 @@
+#include "Sim.h"
+#include "Looper.h"
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+-- Store capacity test :
+Events of all slots and the onsets of the loop being recorded share the store (see LooperStore.cpp).
+  - longest recorded loop : phrases of 8th notes at 125 BPM (2 bytes deltas, the usual event size), all notes
+    different, are played twice (and one more note) on slot 1 of an empty store, one more note each time, until
+    one is not looped. The longest one looped must have at least CAPACITY_LOOP_NOTES notes.
+  - longest loop : notes are overdubbed on that loop (8th notes, half way between its own notes) until the store is
+    full. The slot must then hold at least CAPACITY_STORE_NOTES notes.
+Each phrase is played on a freshly booted looper (one process per phrase), the longest one looped is played again
+to be overdubbed.
+*/
+
+#define CAPACITY_LOOP_NOTES  30   //Baseline : 32 notes per slot, of 4 slots
+#define CAPACITY_STORE_NOTES 100  //One loop, overdubbed
+#define CAPACITY_STEP        240  //8th notes (ms, 1 tick = 1ms at 125 BPM)
+#define CAPACITY_MAX         64
+#define CAPACITY_PASS_US     500  //loop() pass cost : timing is not checked here
+
+//Results of one phrase (written by its child process)
+typedef struct
+{
+  byte looped;  //Notes kept (0 : not looped)
+  byte stored;  //Notes once overdubbed until full
+} tCapacityResult;
+
+tCapacityResult * pCapacityResult;
+
+//Note played at t (us), for len ms
+void CapacityNote(unsigned long t, byte note, unsigned int len)
+{
+  SimMIDIInMsg(t, 3, 0x90, note, 100);
+  SimMIDIInMsg(t + len*1000UL, 3, 0x80, note, 0x40);
+}
+
+void CapacityRun(byte count, boolean overdub, tCapacityResult * r)
+{
+  unsigned long t0, t;
+  unsigned int delay, i;
+  byte channel, size;
+
+  SimBoot();
+  SimRun(SimNow() + 100000);
+  SimPress(1, 1200); //Record slot 1
+
+  t0 = SimNow() + 20000;
+  for (i = 0; i < 2*count + 1U; i++)
+  {
+    t = t0 + i*CAPACITY_STEP*1000UL;
+    CapacityNote(t, 30 + (i % count), 200);
+    SimRun(t + CAPACITY_STEP*1000UL);
+  }
+  if (!LooperSlotInfo(0, &channel, &size, &delay) || (size != count))
+    return;
+  r->looped = size;
+  if (!overdub)
+    return;
+
+  //Overdub between loop notes until the store is full (notes stop being merged)
+  SimPress(1, 1200);
+  t0 = SimNow() + CAPACITY_STEP*500UL;
+  for (i = 0; i < 255; i++)
+  {
+    t = t0 + i*CAPACITY_STEP*1000UL;
+    CapacityNote(t, 100 + (i % 20), 60);
+    SimRun(t + CAPACITY_STEP*1000UL);
+    LooperSlotInfo(0, &channel, &size, &delay);
+    if (size < count + i + 1) //Not merged : full
+      break;
+  }
+  r->stored = size;
+}
+
+//Runs a phrase in a child process : fresh firmware state
+void CapacityFork(byte count, boolean overdub)
+{
+  pid_t pid;
+
+  memset(pCapacityResult, 0x00, sizeof(tCapacityResult));
+  fflush(stdout);
+  pid = fork();
+  if (!pid)
+  {
+    CapacityRun(count, overdub, pCapacityResult);
+    exit(0);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+int main()
+{
+  byte count, looped = 0;
+  boolean ok;
+
+  pCapacityResult = (tCapacityResult *)mmap(NULL, sizeof(tCapacityResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  SimPassCost(CAPACITY_PASS_US, 0);
+  for (count = 8; count <= CAPACITY_MAX; count++)
+  {
+    CapacityFork(count, false);
+    if (!pCapacityResult->looped)
+      break;
+    looped = count;
+  }
+  CapacityFork(looped, true);
+
+  ok = (looped >= CAPACITY_LOOP_NOTES) && (pCapacityResult->stored >= CAPACITY_STORE_NOTES);
+  printf("Store capacity : longest recorded loop %u notes (>= %u), %u notes once overdubbed (>= %u)%s\n",
+         looped, CAPACITY_LOOP_NOTES, pCapacityResult->stored, CAPACITY_STORE_NOTES, ok ? "" : "  FAILED");
+  return ok ? 0 : 1;
+}
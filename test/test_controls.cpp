@@ -0,0 +1,101 @@
+#include "Sim.h"
+#include "Looper.h"
+#include <stdio.h>
+
+/*
+-- Controls test :
+Knob 2 is shared (see LooperSetup) : inspector paging while the inspector is shown, quantization otherwise.
+  - inspector : opened by a 1s hold on button 3 (Long event : shown while the button is still held, the mode is
+    not changed on release), knob 2 moves must page it and leave the quantization grid as is, and change the
+    grid again once it is closed
+  - quantization settings : each double press on button 3 makes knob 2 set the next one (grid, strength, swing),
+    knob 2 moves must only change the selected one
+Settings are read from the firmware globals (indexes in the tables of Looper.cpp).
+*/
+
+#define CONTROLS_PASS_US 500     //loop() pass cost : timing is not checked here
+#define CONTROLS_KNOB_US 300000  //Knob filter and check delay
+
+extern byte quantGrid;
+extern byte quantStrength;
+extern byte quantSwing;
+extern byte quantEdit;
+extern unsigned int debugPage;
+
+//Same as in Looper.cpp
+typedef enum
+{
+  eLooperManual,
+  eLooperAuto
+} tLooperMode;
+extern tLooperMode looperMode;
+
+void ControlsKnob(int value)
+{
+  SimKnob(1, value);
+  SimRun(SimNow() + CONTROLS_KNOB_US);
+}
+
+void ControlsDouble()
+{
+  SimPress(0, 100);
+  SimPress(0, 100);
+}
+
+//Compares settings to expected ones, returns false on a difference
+boolean ControlsCheck(const char * name, byte grid, byte strength, byte swing, byte edit, boolean inspector)
+{
+  boolean ok = (quantGrid == grid) && (quantStrength == strength) && (quantSwing == swing) && (quantEdit == edit) &&
+               ((debugPage != 0xFFFF) == inspector);
+
+  printf("  %-28s grid %u  strength %u  swing %u  knob 2 sets %u  inspector %s%s\n", name, quantGrid, quantStrength,
+         quantSwing, quantEdit, (debugPage != 0xFFFF) ? "shown" : "closed", ok ? "" : "  FAILED");
+  return ok;
+}
+
+int main()
+{
+  boolean ok, held;
+  unsigned int page;
+  tLooperMode mode;
+
+  SimPassCost(CONTROLS_PASS_US, 0);
+  SimBoot();
+  SimRun(SimNow() + 100000);
+  printf("Controls :\n");
+
+  ControlsKnob(1023);
+  ok = ControlsCheck("grid off", 0, 0, 0, 0, false);
+
+  mode = looperMode;
+  SimButton(0, true);
+  SimRun(SimNow() + 1100000);
+  held = (debugPage != 0xFFFF);
+  SimButton(0, false);
+  SimRun(SimNow() + 50000);
+  printf("  1s hold : inspector %s while held, mode %s on release%s\n", held ? "shown" : "closed",
+         (looperMode == mode) ? "kept" : "changed", (held && (looperMode == mode)) ? "" : "  FAILED");
+  ok = held && (looperMode == mode) && ok;
+  page = debugPage;
+  ControlsKnob(512);
+  ok = ControlsCheck("inspector, knob 2 moved", 0, 0, 0, 0, true) && ok;
+  if (debugPage == page)
+  {
+    printf("  inspector page unchanged by knob 2  FAILED\n");
+    ok = false;
+  }
+  SimPress(0, 1200);
+  ControlsKnob(0);
+  ok = ControlsCheck("inspector closed, 1/32", 6, 0, 0, 0, false) && ok;
+
+  ControlsDouble();
+  ControlsKnob(640);
+  ok = ControlsCheck("double press, strength 75%", 6, 1, 0, 1, false) && ok;
+  ControlsDouble();
+  ControlsKnob(0);
+  ok = ControlsCheck("double press, swing 50%", 6, 1, 4, 2, false) && ok;
+  ControlsDouble();
+  ControlsKnob(1023);
+  ok = ControlsCheck("double press, grid off", 0, 1, 4, 0, false) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#include "Sim.h"
+#include "Looper.h"
+#include <stdio.h>
+
+/*
+-- Loop drift test :
+Records two loops (slot 1 : 4 notes on channel 1, slot 2 : 4 notes on channel 2, twice as long), then lets them
+play for thousands of cycles with late loop() passes (up to DRIFT_PASS_US + DRIFT_JITTER_US).
+Without incoming clock, 1 tick = 1ms : the first note of cycle k of a slot is due at its first date + k * loop length.
+Each first note on the wire is compared to that date :
+  - error : any single note later than DRIFT_LATE_US (late pass, notes of both slots on the wire at once)
+  - drift : mean error of the last DRIFT_WINDOW cycles vs the first ones, past DRIFT_MAX_US
+A wrap processed late must not push the next cycles : fails on any drift, or on a missing cycle.
+*/
+
+#define DRIFT_SECONDS   2500    //Virtual time played (5000 cycles of slot 1)
+#define DRIFT_PASS_US   200     //loop() pass cost
+#define DRIFT_JITTER_US 2000    //Added to each pass : random(DRIFT_JITTER_US)
+#define DRIFT_LATE_US   5000    //Worst error of a single note
+#define DRIFT_MAX_US    500     //Worst drift (mean error, last cycles vs first ones) : 0.1us per cycle
+#define DRIFT_WINDOW    100     //Cycles averaged
+
+unsigned long LoopLength(byte slot);
+
+//Records a loop on the current slot : 4 notes on channel, note interval us, phrase played twice
+void DriftRecord(byte channel, byte note, unsigned long us)
+{
+  unsigned long t;
+  byte i;
+
+  SimPress(1, 1200);
+  t = SimNow() + 10000;
+  for (i = 0; i < 2*4 + 1; i++)
+  {
+    SimMIDIInMsg(t + i*us, 3, 0x90 | channel, note + (i % 4)*2, 100);
+    SimMIDIInMsg(t + i*us + us/2, 3, 0x80 | channel, note + (i % 4)*2, 0x40);
+  }
+  SimRun(t + (2*4 + 2)*us);
+}
+
+//Returns false when the slot drifts or misses cycles
+boolean DriftCheck(const char * name, byte channel, byte note, unsigned long length, tSimMsg * msgs, unsigned int count, unsigned long end)
+{
+  unsigned long first = 0, cycles = 0, expected;
+  long error, worst = 0, start = 0, last = 0;
+  long * aErrors;
+  unsigned int i;
+  boolean ok;
+
+  aErrors = (long *)malloc(count * sizeof(long));
+  for (i = 0; i < count; i++)
+  {
+    tSimMsg * m = &msgs[i];
+
+    if ((m->len != 3) || (m->aData[0] != (0x90 | channel)) || (m->aData[1] != note))
+      continue;
+    if (!cycles)
+      first = m->us;
+    error = (long)(m->us - first) - (long)(cycles * length);
+    aErrors[cycles++] = error;
+    if (labs(error) > labs(worst))
+      worst = error;
+  }
+
+  //Cycles started before end (last one may still be on the wire)
+  expected = (end - first) / length;
+  ok = (cycles >= expected) && (cycles >= 2*DRIFT_WINDOW) && (labs(worst) <= DRIFT_LATE_US);
+  if (cycles >= 2*DRIFT_WINDOW)
+  {
+    for (i = 0; i < DRIFT_WINDOW; i++)
+    {
+      start += aErrors[i];
+      last  += aErrors[cycles - DRIFT_WINDOW + i];
+    }
+    start /= DRIFT_WINDOW;
+    last  /= DRIFT_WINDOW;
+    ok = ok && (labs(last - start) <= DRIFT_MAX_US);
+  }
+  printf("  %s : %lums loop, %lu/%lu cycles, worst error %+ld us, drift %+ld us (first %+ld, last %+ld)%s\n", name,
+         length / 1000, cycles, expected, worst, last - start, start, last, ok ? "" : "  FAILED");
+  free(aErrors);
+  return ok;
+}
+
+int main()
+{
+  unsigned long length1, length2, end;
+  unsigned int count;
+  tSimMsg * msgs;
+  boolean ok;
+
+  SimPassCost(DRIFT_PASS_US, DRIFT_JITTER_US);
+  SimBoot();
+  SimRun(SimNow() + 100000);
+
+  //Slot 1 : 500ms loop, slot 2 : 1s loop
+  DriftRecord(0, 60, 125000);
+  SimKnob(0, 1023 - 1024/MAX_SLOTS - 1024/MAX_SLOTS/2); //Middle of slot 2 range
+  SimRun(SimNow() + 300000);
+  DriftRecord(1, 48, 250000);
+  length1 = LoopLength(0) * 1000UL; //1 tick = 1ms
+  length2 = LoopLength(1) * 1000UL;
+
+  SimMIDIOutClear();
+  end = SimNow() + DRIFT_SECONDS * 1000000UL;
+  SimRun(end);
+
+  printf("Loop drift : %us played, loop() pass %u-%u us\n", DRIFT_SECONDS, DRIFT_PASS_US, DRIFT_PASS_US + DRIFT_JITTER_US);
+  count = SimMIDIOutMsgs(&msgs);
+  ok = DriftCheck("slot 1", 0, 60, length1, msgs, count, end);
+  ok = DriftCheck("slot 2", 1, 48, length2, msgs, count, end) && ok;
+  return ok ? 0 : 1;
+}
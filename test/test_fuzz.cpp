@@ -0,0 +1,320 @@
+#include "Sim.h"
+#include "MIDIProcessor.h"
+#include <stdio.h>
+
+/*
+-- MIDI parser fuzzing :
+Byte streams are given straight to the parser (MIDIRead, as MIDIProcessorUpdate does), the board runs
+between batches of FUZZ_BATCH bytes to send the passthrough output. Two kinds of streams :
+  - random bytes (data bytes, channel and system status bytes, realtime) : notes and SysEx events must be
+    those of a reference decoder written from the MIDI spec (realtime anywhere, running status, system
+    common data bytes, SysEx ended by any status byte), and the parser never holds more data bytes than
+    its message has (aData bounds)
+  - well formed streams of every message type, with running status, SysEx and realtime bytes inside
+    messages : every note (NoteOff sent as NoteOn velocity 0 too) must reach the note callback, none lost
+    nor counted as input error ; SysEx contents must reach the SysEx callback
+Fails on the first difference. Out of bounds writes inside a call (aData included) are caught by a sanitized
+build, which stops on the first error :
+  make clean && CXXFLAGS="-O1 -g -fsanitize=address,undefined -fno-sanitize-recover=all" make test
+*/
+
+#define FUZZ_STREAMS 20      //Streams of each kind
+#define FUZZ_BYTES   100000  //Bytes per stream
+#define FUZZ_BATCH   16      //Bytes parsed between two output runs
+#define FUZZ_PASS_US 500     //loop() pass cost : output is sent, timing is not checked here
+
+void MIDIRead(byte b, unsigned long us);
+
+//Parser state, same layout as in MIDIProcessor.cpp (bounds check)
+typedef struct
+{
+  byte status;
+  byte length;
+  byte count;
+  byte aData[2];
+  boolean running;
+  unsigned long timestamp;
+} tMIDIParser;
+extern tMIDIParser parser;
+
+//Note or SysEx event, as seen by a callback
+typedef struct
+{
+  byte kind;  //'N' : note, 'S' : SysEx
+  byte a;     //Channel, SysEx event
+  byte b;     //Note, SysEx byte
+  byte c;     //Velocity (0 : NoteOff)
+} tFuzzEvent;
+
+#define FUZZ_EVENTS FUZZ_BYTES  //At most one event per byte
+
+tFuzzEvent aFuzzGot[FUZZ_EVENTS];      //From the firmware callbacks
+unsigned int fuzzGotCount;
+tFuzzEvent aFuzzExpected[FUZZ_EVENTS]; //From the reference decoder or the stream generator
+unsigned int fuzzExpectedCount;
+
+unsigned long fuzzRandom = 12345;
+
+unsigned long FuzzRandom(unsigned long range)
+{
+  fuzzRandom = fuzzRandom * 1103515245UL + 12345;
+  return ((fuzzRandom >> 16) & 0x7FFF) % range;
+}
+
+void FuzzEvent(tFuzzEvent * aEvents, unsigned int * count, byte kind, byte a, byte b, byte c)
+{
+  tFuzzEvent * e = &aEvents[(*count)++];
+
+  e->kind = kind;
+  e->a    = a;
+  e->b    = b;
+  e->c    = c;
+}
+
+byte FuzzNoteCb(byte channel, byte note, byte velocity, unsigned long timestamp)
+{
+  FuzzEvent(aFuzzGot, &fuzzGotCount, 'N', channel, note, velocity);
+  return 0; //Passed through
+}
+
+void FuzzSysExCb(tSysExEvent event, byte b)
+{
+  FuzzEvent(aFuzzGot, &fuzzGotCount, 'S', event, b, 0);
+}
+
+
+// ######## REFERENCE DECODER #########
+byte refStatus;  //Status data bytes belong to, 0 : none
+byte refLength;
+byte refCount;
+byte aRefData[2];
+boolean refSysEx;
+
+//Data bytes of a status byte (MIDI 1.0 spec)
+byte RefLength(byte status)
+{
+  switch (status & 0xF0)
+  {
+    case 0xC0 : case 0xD0 : return 1;
+    case 0xF0 : return ((status == 0xF1) || (status == 0xF3)) ? 1 : ((status == 0xF2) ? 2 : 0);
+    default : return 2;
+  }
+}
+
+void RefRead(byte b)
+{
+  if (b >= 0xF8) //Realtime : anywhere, changes nothing
+    return;
+  if (refSysEx)
+  {
+    if (!(b & 0x80))
+    {
+      FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'S', eSysExData, b, 0);
+      return;
+    }
+    refSysEx = false;
+    FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'S', (b == 0xF7) ? eSysExEnd : eSysExAbort, b, 0);
+    if (b == 0xF7)
+      return;
+  }
+  if (b & 0x80)
+  {
+    refStatus = b;
+    refLength = RefLength(b);
+    refCount  = 0;
+    if (b == 0xF0)
+    {
+      refSysEx = true;
+      FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'S', eSysExStart, b, 0);
+    }
+    if ((b >= 0xF0) && !refLength) //No running status after a system message
+      refStatus = 0;
+    return;
+  }
+  if (!refStatus)
+    return;
+  if (refStatus >= 0xF0)
+  {
+    if (++refCount == refLength)
+      refStatus = 0;
+    return;
+  }
+  aRefData[refCount++] = b;
+  if (refCount < refLength)
+    return;
+  refCount = 0; //Running status
+  if ((refStatus & 0xF0) == 0x90)
+    FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'N', refStatus & 0x0F, aRefData[0], aRefData[1]);
+  else if ((refStatus & 0xF0) == 0x80)
+    FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'N', refStatus & 0x0F, aRefData[0], 0);
+}
+
+
+// ######## STREAMS #########
+byte aFuzzIn[FUZZ_BYTES];
+unsigned int fuzzInCount;
+
+void FuzzByte(byte b)
+{
+  if (fuzzInCount < FUZZ_BYTES)
+    aFuzzIn[fuzzInCount++] = b;
+}
+
+//Random bytes, status bytes often enough to reach every parser path
+void FuzzRandomStream()
+{
+  while (fuzzInCount < FUZZ_BYTES)
+  {
+    unsigned long r = FuzzRandom(100);
+
+    if (r < 70)
+      FuzzByte(FuzzRandom(0x80));
+    else if (r < 90)
+      FuzzByte(0x80 | FuzzRandom(0x70));
+    else if (r < 95)
+      FuzzByte(0xF0 | FuzzRandom(8));
+    else
+      FuzzByte(0xF8 | FuzzRandom(8));
+  }
+}
+
+//Byte of a well formed stream : a realtime byte may come before it
+void FuzzWellByte(byte b)
+{
+  static const byte aRealtime[] = {0xF8, 0xFA, 0xFB, 0xFC, 0xFE};
+
+  if (!FuzzRandom(8))
+    FuzzByte(aRealtime[FuzzRandom(sizeof(aRealtime))]);
+  FuzzByte(b);
+}
+
+//Every message type, running status when possible (not after system messages), expected notes
+void FuzzWellStream()
+{
+  byte running = 0;
+
+  while (fuzzInCount < FUZZ_BYTES - 80)
+  {
+    unsigned long r = FuzzRandom(100);
+    byte channel = FuzzRandom(16);
+    byte status, d1 = FuzzRandom(0x80), d2 = FuzzRandom(0x80), i, len;
+
+    if (r < 85) //Channel message
+    {
+      static const byte aTypes[] = {0x80, 0x90, 0x90, 0x90, 0xA0, 0xB0, 0xB0, 0xC0, 0xD0, 0xE0};
+
+      status = aTypes[FuzzRandom(sizeof(aTypes))] | channel;
+      if ((running & 0xF0) && FuzzRandom(2)) //Same status again : running status
+        status = running;
+      if (status != running)
+        FuzzWellByte(status);
+      running = status;
+      FuzzWellByte(d1);
+      if (RefLength(status) == 2)
+        FuzzWellByte(d2);
+      if ((status & 0xF0) == 0x90)
+        FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'N', status & 0x0F, d1, d2);
+      else if ((status & 0xF0) == 0x80)
+        FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'N', status & 0x0F, d1, 0);
+    }
+    else if (r < 92) //SysEx
+    {
+      len = 1 + FuzzRandom(40);
+      FuzzWellByte(0xF0);
+      FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'S', eSysExStart, 0xF0, 0);
+      for (i = 0; i < len; i++)
+      {
+        byte b = i ? FuzzRandom(0x80) : 0x43; //Not the looper's ID
+
+        FuzzWellByte(b);
+        FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'S', eSysExData, b, 0);
+      }
+      FuzzWellByte(0xF7);
+      FuzzEvent(aFuzzExpected, &fuzzExpectedCount, 'S', eSysExEnd, 0xF7, 0);
+      running = 0;
+    }
+    else //System common
+    {
+      static const byte aCommon[] = {0xF1, 0xF2, 0xF3, 0xF6};
+
+      status = aCommon[FuzzRandom(sizeof(aCommon))];
+      FuzzWellByte(status);
+      for (i = 0; i < RefLength(status); i++)
+        FuzzWellByte(FuzzRandom(0x80));
+      running = 0;
+    }
+  }
+}
+
+//Parses the stream, returns false on the first difference
+boolean FuzzRun(const char * name, unsigned int stream, boolean reference)
+{
+  unsigned int i, errors = MIDIInErrors();
+
+  fuzzInCount       = 0;
+  fuzzGotCount      = 0;
+  fuzzExpectedCount = 0;
+  if (reference)
+    FuzzRandomStream();
+  else
+    FuzzWellStream();
+
+  for (i = 0; i < fuzzInCount; i++)
+  {
+    MIDIRead(aFuzzIn[i], SimNow());
+    if (reference)
+      RefRead(aFuzzIn[i]);
+    if ((parser.length > 2) || (parser.count > parser.length))
+    {
+      printf("  %s %u : byte %u (0x%02X), parser holds %u of %u data bytes\n", name, stream, i, aFuzzIn[i], parser.count, parser.length);
+      return false;
+    }
+    if (!((i + 1) % FUZZ_BATCH))
+      SimRun(SimNow() + FUZZ_BATCH*SIM_BYTE_US);
+  }
+
+  for (i = 0; (i < fuzzGotCount) && (i < fuzzExpectedCount); i++)
+  {
+    if (memcmp(&aFuzzGot[i], &aFuzzExpected[i], sizeof(tFuzzEvent)))
+      break;
+  }
+  if ((i < fuzzGotCount) || (i < fuzzExpectedCount))
+  {
+    printf("  %s %u : event %u of %u (%u expected) differs\n", name, stream, i, fuzzGotCount, fuzzExpectedCount);
+    return false;
+  }
+  if (!reference && (MIDIInErrors() != errors))
+  {
+    printf("  %s %u : %u input errors on a well formed stream\n", name, stream, MIDIInErrors() - errors);
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  unsigned long events = 0;
+  unsigned int i;
+
+  SimPassCost(FUZZ_PASS_US, 0);
+  SimBoot();
+  SimRun(SimNow() + 100000);
+  MIDIRegisterNoteCb(FuzzNoteCb);
+  MIDIRegisterSysExCb(FuzzSysExCb);
+
+  for (i = 0; i < FUZZ_STREAMS; i++)
+  {
+    if (!FuzzRun("random", i, true))
+      return 1;
+    events += fuzzGotCount;
+  }
+  for (i = 0; i < FUZZ_STREAMS; i++)
+  {
+    if (!FuzzRun("well formed", i, false))
+      return 1;
+    events += fuzzGotCount;
+  }
+  printf("MIDI parser fuzzing : %u random and %u well formed streams of %u bytes, %lu events checked\n",
+         FUZZ_STREAMS, FUZZ_STREAMS, FUZZ_BYTES, events);
+  return 0;
+}
@@ -0,0 +1,358 @@
+#include "Sim.h"
+#include "Looper.h"
+#include "Profile.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/*
+-- Golden traces :
+Each scenario replays an input trace (timestamped MIDI messages, button presses, knob moves) on a freshly
+booted looper, and compares its MIDI output to the golden one :
+  - every golden message must be sent, within GOLDEN_TOLERANCE_US of its date, and nothing else
+    (realtime bytes aside : the clock is only passed through with MIDI_THRU_REALTIME)
+  - loop events must not be later than GOLDEN_LATE_TICKS (lateness zone, see Profile.cpp)
+  - LooperUpdate runs over its task budget (300us, host time : the AVR is ~100 times slower) must stay under
+    1 in GOLDEN_CPU_SHARE : a single long run may be the host's doing (interrupts, other virtual machines).
+    Zone counters are halved when full (see Profile.cpp) : runs are not all counted, their share is.
+Reports, for each scenario : worst error on the wire, worst lateness, longest LooperUpdate run and runs over budget.
+After a deliberate change of output, "test_golden -g" prints the new golden outputs : check them, then paste.
+Buttons are numbered as on the board (see README) : index 1 long press records (slotRecordCb),
+short press plays / mutes (slotPlayMuteCb).
+*/
+
+#define GOLDEN_TOLERANCE_US 2000  //Error allowed on the date of an output message
+#define GOLDEN_LATE_TICKS   2     //Worst lateness of a loop event (1 tick = 1ms at 125 BPM)
+#define GOLDEN_CPU_SHARE    1000  //LooperUpdate runs over budget allowed : 1 in GOLDEN_CPU_SHARE
+
+#define GOLDEN_PRESS 0x00  //Input step : button data1 held for value ms
+#define GOLDEN_KNOB  0x01  //Input step : knob data1 moved to value (0-1023)
+
+//Input step (in date order)
+typedef struct
+{
+  unsigned long at;     //ms from scenario start
+  byte          status; //MIDI status, GOLDEN_PRESS or GOLDEN_KNOB
+  byte          data1;
+  byte          data2;
+  unsigned int  value;
+} tGoldenIn;
+
+//Output message (realtime bytes are not compared)
+typedef struct
+{
+  unsigned long at;     //ms from scenario start
+  byte          aData[3];
+} tGoldenOut;
+
+typedef struct
+{
+  const char *       name;
+  const tGoldenIn *  aIn;
+  unsigned int       inCount;
+  const tGoldenOut * aOut;
+  unsigned int       outCount;
+  unsigned long      end;      //ms
+  unsigned long      clockUs;  //Incoming MIDI clock period, 0 : none
+  unsigned long      tempoAt;  //ms : clock period changes to tempoUs
+  unsigned long      tempoUs;
+} tGoldenScenario;
+
+#define GOLDEN_COUNT(_a) (sizeof(_a)/sizeof(_a[0]))
+
+//Note held for _len ms, velocity 100
+#define NOTE(_at, _ch, _note, _len) {_at, 0x90 | (_ch), _note, 100}, {(_at) + (_len), 0x80 | (_ch), _note, 0x40}
+
+//Record on current slot (long press), then a 4 notes phrase twice and its first note (250ms per note)
+#define RECORD(_at, _ch, _n1, _n2, _n3, _n4) \
+  {_at, GOLDEN_PRESS, 1, 0, 1200}, \
+  NOTE(_at + 1300, _ch, _n1, 125), NOTE(_at + 1550, _ch, _n2, 125), NOTE(_at + 1800, _ch, _n3, 125), NOTE(_at + 2050, _ch, _n4, 125), \
+  NOTE(_at + 2300, _ch, _n1, 125), NOTE(_at + 2550, _ch, _n2, 125), NOTE(_at + 2800, _ch, _n3, 125), NOTE(_at + 3050, _ch, _n4, 125), \
+  NOTE(_at + 3300, _ch, _n1, 125)
+
+//Live notes passed through while slot 1 is idle
+const tGoldenIn aPassIn[] =
+{
+  NOTE(100, 0, 60, 200), NOTE(400, 0, 64, 100), NOTE(600, 1, 36, 300),
+  {1000, 0xB0, 7, 90}, {1100, 0xE0, 0, 72},
+};
+
+const tGoldenOut aPassOut[] =
+{
+  {  102, {0x90,  60, 100}}, {  301, {0x80,  60,  64}}, {  401, {0x90,  64, 100}}, {  501, {0x80,  64,  64}},
+  {  602, {0x91,  36, 100}}, {  901, {0x81,  36,  64}}, { 1002, {0xB0,   7,  90}}, { 1102, {0xE0,   0,  72}},
+};
+
+//Record a loop on slot 1, let it play twice
+const tGoldenIn aRecordIn[] =
+{
+  RECORD(0, 0, 60, 62, 64, 65),
+};
+
+const tGoldenOut aRecordOut[] =
+{
+  { 1302, {0x90,  60, 100}}, { 1426, {0x80,  60,  64}}, { 1551, {0x90,  62, 100}}, { 1676, {0x80,  62,  64}},
+  { 1801, {0x90,  64, 100}}, { 1926, {0x80,  64,  64}}, { 2051, {0x90,  65, 100}}, { 2176, {0x80,  65,  64}},
+  { 2301, {0x90,  60, 100}}, { 2426, {0x80,  60,  64}}, { 2551, {0x90,  62, 100}}, { 2676, {0x80,  62,  64}},
+  { 2801, {0x90,  64, 100}}, { 2926, {0x80,  64,  64}}, { 3051, {0x90,  65, 100}}, { 3176, {0x80,  65,  64}},
+  { 3301, {0x90,  60, 100}}, { 3301, {0x90,  60, 100}}, { 3425, {0x80,  60,  64}}, { 3426, {0x80,  60,  64}},
+  { 3551, {0x90,  62, 100}}, { 3675, {0x80,  62,  64}}, { 3801, {0x90,  64, 100}}, { 3925, {0x80,  64,  64}},
+  { 4051, {0x90,  65, 100}}, { 4175, {0x80,  65,  64}}, { 4301, {0x90,  60, 100}}, { 4425, {0x80,  60,  64}},
+  { 4551, {0x90,  62, 100}}, { 4675, {0x80,  62,  64}}, { 4801, {0x90,  64, 100}}, { 4925, {0x80,  64,  64}},
+  { 5051, {0x90,  65, 100}}, { 5175, {0x80,  65,  64}}, { 5301, {0x90,  60, 100}}, { 5425, {0x80,  60,  64}},
+  { 5551, {0x90,  62, 100}}, { 5675, {0x80,  62,  64}}, { 5801, {0x90,  64, 100}}, { 5925, {0x80,  64,  64}},
+};
+
+//Record a loop on slot 1, mute it (short press), play it again
+const tGoldenIn aMuteIn[] =
+{
+  RECORD(0, 0, 60, 62, 64, 65),
+  {4400, GOLDEN_PRESS, 1, 0, 200},
+  {5900, GOLDEN_PRESS, 1, 0, 200},
+};
+
+const tGoldenOut aMuteOut[] =
+{
+  { 1302, {0x90,  60, 100}}, { 1426, {0x80,  60,  64}}, { 1551, {0x90,  62, 100}}, { 1676, {0x80,  62,  64}},
+  { 1801, {0x90,  64, 100}}, { 1926, {0x80,  64,  64}}, { 2051, {0x90,  65, 100}}, { 2176, {0x80,  65,  64}},
+  { 2301, {0x90,  60, 100}}, { 2426, {0x80,  60,  64}}, { 2551, {0x90,  62, 100}}, { 2676, {0x80,  62,  64}},
+  { 2801, {0x90,  64, 100}}, { 2926, {0x80,  64,  64}}, { 3051, {0x90,  65, 100}}, { 3176, {0x80,  65,  64}},
+  { 3301, {0x90,  60, 100}}, { 3301, {0x90,  60, 100}}, { 3425, {0x80,  60,  64}}, { 3426, {0x80,  60,  64}},
+  { 3551, {0x90,  62, 100}}, { 3675, {0x80,  62,  64}}, { 3801, {0x90,  64, 100}}, { 3925, {0x80,  64,  64}},
+  { 4051, {0x90,  65, 100}}, { 4175, {0x80,  65,  64}}, { 4301, {0x90,  60, 100}}, { 4425, {0x80,  60,  64}},
+  { 4551, {0x90,  62, 100}}, { 4616, {0xB0, 123,   0}}, { 4675, {0x80,  62,  64}}, { 6301, {0x90,  60, 100}},
+  { 6425, {0x80,  60,  64}}, { 6551, {0x90,  62, 100}}, { 6675, {0x80,  62,  64}}, { 6801, {0x90,  64, 100}},
+  { 6925, {0x80,  64,  64}}, { 7051, {0x90,  65, 100}}, { 7175, {0x80,  65,  64}}, { 7301, {0x90,  60, 100}},
+  { 7425, {0x80,  60,  64}}, { 7551, {0x90,  62, 100}}, { 7675, {0x80,  62,  64}}, { 7801, {0x90,  64, 100}},
+  { 7925, {0x80,  64,  64}},
+};
+
+//Slot 1 : 1s loop, slot 2 : 1s loop on channel 2, recorded over slot 1
+const tGoldenIn aSlotsIn[] =
+{
+  RECORD(0, 0, 60, 62, 64, 65),
+  {4000, GOLDEN_KNOB, 0, 0, 1023 - 1024/MAX_SLOTS - 1024/MAX_SLOTS/2}, //Middle of slot 2 range
+  RECORD(4200, 1, 48, 55, 52, 55),
+};
+
+const tGoldenOut aSlotsOut[] =
+{
+  { 1302, {0x90,  60, 100}}, { 1426, {0x80,  60,  64}}, { 1551, {0x90,  62, 100}}, { 1676, {0x80,  62,  64}},
+  { 1801, {0x90,  64, 100}}, { 1926, {0x80,  64,  64}}, { 2051, {0x90,  65, 100}}, { 2176, {0x80,  65,  64}},
+  { 2301, {0x90,  60, 100}}, { 2426, {0x80,  60,  64}}, { 2551, {0x90,  62, 100}}, { 2676, {0x80,  62,  64}},
+  { 2801, {0x90,  64, 100}}, { 2926, {0x80,  64,  64}}, { 3051, {0x90,  65, 100}}, { 3176, {0x80,  65,  64}},
+  { 3301, {0x90,  60, 100}}, { 3301, {0x90,  60, 100}}, { 3425, {0x80,  60,  64}}, { 3426, {0x80,  60,  64}},
+  { 3551, {0x90,  62, 100}}, { 3675, {0x80,  62,  64}}, { 3801, {0x90,  64, 100}}, { 3925, {0x80,  64,  64}},
+  { 4051, {0x90,  65, 100}}, { 4175, {0x80,  65,  64}}, { 4301, {0x90,  60, 100}}, { 4425, {0x80,  60,  64}},
+  { 4551, {0x90,  62, 100}}, { 4675, {0x80,  62,  64}}, { 4801, {0x90,  64, 100}}, { 4925, {0x80,  64,  64}},
+  { 5051, {0x90,  65, 100}}, { 5175, {0x80,  65,  64}}, { 5301, {0x90,  60, 100}}, { 5425, {0x80,  60,  64}},
+  { 5502, {0x91,  48, 100}}, { 5551, {0x90,  62, 100}}, { 5627, {0x81,  48,  64}}, { 5675, {0x80,  62,  64}},
+  { 5752, {0x91,  55, 100}}, { 5801, {0x90,  64, 100}}, { 5877, {0x81,  55,  64}}, { 5925, {0x80,  64,  64}},
+  { 6002, {0x91,  52, 100}}, { 6051, {0x90,  65, 100}}, { 6127, {0x81,  52,  64}}, { 6175, {0x80,  65,  64}},
+  { 6252, {0x91,  55, 100}}, { 6301, {0x90,  60, 100}}, { 6377, {0x81,  55,  64}}, { 6425, {0x80,  60,  64}},
+  { 6502, {0x91,  48, 100}}, { 6551, {0x90,  62, 100}}, { 6627, {0x81,  48,  64}}, { 6675, {0x80,  62,  64}},
+  { 6752, {0x91,  55, 100}}, { 6801, {0x90,  64, 100}}, { 6877, {0x81,  55,  64}}, { 6925, {0x80,  64,  64}},
+  { 7002, {0x91,  52, 100}}, { 7051, {0x90,  65, 100}}, { 7127, {0x81,  52,  64}}, { 7175, {0x80,  65,  64}},
+  { 7252, {0x91,  55, 100}}, { 7301, {0x90,  60, 100}}, { 7302, {0x91,  48, 100}}, { 7376, {0x81,  55,  64}},
+  { 7425, {0x80,  60,  64}}, { 7426, {0x81,  48,  64}}, { 7501, {0x91,  48, 100}}, { 7551, {0x90,  62, 100}},
+  { 7552, {0x91,  55, 100}}, { 7626, {0x81,  48,  64}}, { 7675, {0x80,  62,  64}}, { 7676, {0x81,  55,  64}},
+  { 7801, {0x90,  64, 100}}, { 7802, {0x91,  52, 100}}, { 7925, {0x80,  64,  64}}, { 7926, {0x81,  52,  64}},
+  { 8051, {0x90,  65, 100}}, { 8052, {0x91,  55, 100}}, { 8175, {0x80,  65,  64}}, { 8176, {0x81,  55,  64}},
+  { 8301, {0x90,  60, 100}}, { 8302, {0x91,  48, 100}}, { 8425, {0x80,  60,  64}}, { 8426, {0x81,  48,  64}},
+  { 8551, {0x90,  62, 100}}, { 8552, {0x91,  55, 100}}, { 8675, {0x80,  62,  64}}, { 8676, {0x81,  55,  64}},
+  { 8801, {0x90,  64, 100}}, { 8802, {0x91,  52, 100}}, { 8925, {0x80,  64,  64}}, { 8926, {0x81,  52,  64}},
+  { 9051, {0x90,  65, 100}}, { 9052, {0x91,  55, 100}}, { 9175, {0x80,  65,  64}}, { 9176, {0x81,  55,  64}},
+  { 9301, {0x90,  60, 100}}, { 9302, {0x91,  48, 100}}, { 9425, {0x80,  60,  64}}, { 9426, {0x81,  48,  64}},
+  { 9551, {0x90,  62, 100}}, { 9552, {0x91,  55, 100}}, { 9675, {0x80,  62,  64}}, { 9676, {0x81,  55,  64}},
+  { 9801, {0x90,  64, 100}}, { 9802, {0x91,  52, 100}}, { 9925, {0x80,  64,  64}}, { 9926, {0x81,  52,  64}},
+};
+
+//Loop recorded at 125 BPM (incoming clock), clock goes to 150 BPM : the loop follows
+const tGoldenIn aClockIn[] =
+{
+  RECORD(0, 0, 60, 62, 64, 65),
+};
+
+const tGoldenOut aClockOut[] =
+{
+  { 1302, {0x90,  60, 100}}, { 1427, {0x80,  60,  64}}, { 1552, {0x90,  62, 100}}, { 1677, {0x80,  62,  64}},
+  { 1802, {0x90,  64, 100}}, { 1927, {0x80,  64,  64}}, { 2052, {0x90,  65, 100}}, { 2177, {0x80,  65,  64}},
+  { 2302, {0x90,  60, 100}}, { 2427, {0x80,  60,  64}}, { 2552, {0x90,  62, 100}}, { 2677, {0x80,  62,  64}},
+  { 2802, {0x90,  64, 100}}, { 2927, {0x80,  64,  64}}, { 3052, {0x90,  65, 100}}, { 3177, {0x80,  65,  64}},
+  { 3301, {0x90,  60, 100}}, { 3302, {0x90,  60, 100}}, { 3425, {0x80,  60,  64}}, { 3426, {0x80,  60,  64}},
+  { 3551, {0x90,  62, 100}}, { 3675, {0x80,  62,  64}}, { 3801, {0x90,  64, 100}}, { 3925, {0x80,  64,  64}},
+  { 4051, {0x90,  65, 100}}, { 4175, {0x80,  65,  64}}, { 4301, {0x90,  60, 100}}, { 4425, {0x80,  60,  64}},
+  { 4548, {0x90,  62, 100}}, { 4652, {0x80,  62,  64}}, { 4754, {0x90,  64, 100}}, { 4856, {0x80,  64,  64}},
+  { 4960, {0x90,  65, 100}}, { 5063, {0x80,  65,  64}}, { 5168, {0x90,  60, 100}}, { 5271, {0x80,  60,  64}},
+  { 5376, {0x90,  62, 100}}, { 5479, {0x80,  62,  64}}, { 5585, {0x90,  64, 100}}, { 5688, {0x80,  64,  64}},
+  { 5793, {0x90,  65, 100}}, { 5896, {0x80,  65,  64}}, { 6001, {0x90,  60, 100}}, { 6104, {0x80,  60,  64}},
+  { 6209, {0x90,  62, 100}}, { 6313, {0x80,  62,  64}}, { 6418, {0x90,  64, 100}}, { 6521, {0x80,  64,  64}},
+  { 6626, {0x90,  65, 100}}, { 6729, {0x80,  65,  64}}, { 6835, {0x90,  60, 100}}, { 6938, {0x80,  60,  64}},
+  { 7043, {0x90,  62, 100}}, { 7146, {0x80,  62,  64}}, { 7251, {0x90,  64, 100}}, { 7354, {0x80,  64,  64}},
+  { 7459, {0x90,  65, 100}}, { 7563, {0x80,  65,  64}}, { 7668, {0x90,  60, 100}}, { 7771, {0x80,  60,  64}},
+  { 7876, {0x90,  62, 100}}, { 7979, {0x80,  62,  64}},
+};
+
+const tGoldenScenario aScenarios[] =
+{
+  {"passthrough",      aPassIn,   GOLDEN_COUNT(aPassIn),   aPassOut,   GOLDEN_COUNT(aPassOut),   1500, 0, 0, 0},
+  {"record and loop",  aRecordIn, GOLDEN_COUNT(aRecordIn), aRecordOut, GOLDEN_COUNT(aRecordOut), 6000, 0, 0, 0},
+  {"mute and play",    aMuteIn,   GOLDEN_COUNT(aMuteIn),   aMuteOut,   GOLDEN_COUNT(aMuteOut),   8000, 0, 0, 0},
+  {"two slots",        aSlotsIn,  GOLDEN_COUNT(aSlotsIn),  aSlotsOut,  GOLDEN_COUNT(aSlotsOut),  10000, 0, 0, 0},
+  {"clock tempo change", aClockIn, GOLDEN_COUNT(aClockIn), aClockOut,  GOLDEN_COUNT(aClockOut),  8000, 20000, 4500, 16667},
+};
+
+#define GOLDEN_SCENARIOS (sizeof(aScenarios)/sizeof(aScenarios[0]))
+
+//Incoming clock bytes until us
+void GoldenClock(const tGoldenScenario * sc, unsigned long t0, unsigned long * clock, unsigned long us)
+{
+  if (!sc->clockUs)
+    return;
+  while (*clock <= us)
+  {
+    SimMIDIIn(*clock, 0xF8);
+    *clock += (*clock - t0 >= sc->tempoAt*1000) ? sc->tempoUs : sc->clockUs;
+  }
+}
+
+//Prints the output as a golden table
+void GoldenPrint(const tGoldenScenario * sc, tSimMsg * msgs, unsigned int count, unsigned long t0)
+{
+  unsigned int i, n = 0;
+
+  printf("//%s\nconst tGoldenOut a...Out[] =\n{", sc->name);
+  for (i = 0; i < count; i++)
+  {
+    tSimMsg * m = &msgs[i];
+
+    if (m->aData[0] >= 0xF8)
+      continue;
+    printf("%s{%5lu, {0x%02X, %3u, %3u}},", (n++ % 4) ? " " : "\n  ", (m->us - t0 + 500) / 1000,
+           m->aData[0], (m->len > 1) ? m->aData[1] : 0, (m->len > 2) ? m->aData[2] : 0);
+  }
+  printf("\n};\n\n");
+}
+
+//Returns false when the output differs from the golden one, or timing regressed
+boolean GoldenRun(const tGoldenScenario * sc, boolean print)
+{
+  unsigned long t0, clock;
+  unsigned int i, j, count, missing = 0, extra = 0;
+  long worst = 0;
+  tSimMsg * msgs;
+  boolean * aMatched;
+  tProfileStats * late;
+  tProfileStats * cpu;
+  unsigned long runs = 0;
+  boolean ok;
+
+  SimBoot();
+  SimRun(SimNow() + 100000);
+  t0 = SimNow();
+  clock = t0 + sc->clockUs;
+  SimMIDIOutClear();
+  ProfileReset();
+
+  //MIDI input on the wire first (in date order, with the clock), then presses and knobs as time goes
+  for (i = 0; i < sc->inCount; i++)
+  {
+    const tGoldenIn * in = &sc->aIn[i];
+
+    if (in->status < 0x80)
+      continue;
+    GoldenClock(sc, t0, &clock, t0 + in->at*1000);
+    SimMIDIInMsg(t0 + in->at*1000, ((in->status & 0xE0) == 0xC0) ? 2 : 3, in->status, in->data1, in->data2);
+  }
+  GoldenClock(sc, t0, &clock, t0 + sc->end*1000);
+  for (i = 0; i < sc->inCount; i++)
+  {
+    const tGoldenIn * in = &sc->aIn[i];
+
+    if (in->status >= 0x80)
+      continue;
+    SimRun(t0 + in->at*1000);
+    if (in->status == GOLDEN_PRESS)
+      SimPress(in->data1, in->value);
+    else
+      SimKnob(in->data1, in->value);
+  }
+  SimRun(t0 + sc->end*1000);
+
+  count = SimMIDIOutMsgs(&msgs);
+  if (print)
+  {
+    GoldenPrint(sc, msgs, count, t0);
+    return true;
+  }
+
+  //Each output message matches the first unmatched golden one with same bytes, close enough
+  aMatched = (boolean *)calloc(sc->outCount + 1, sizeof(boolean));
+  for (i = 0; i < count; i++)
+  {
+    tSimMsg * m = &msgs[i];
+
+    if (m->aData[0] >= 0xF8)
+      continue;
+    for (j = 0; j < sc->outCount; j++)
+    {
+      const tGoldenOut * g = &sc->aOut[j];
+      long error = (long)(m->us - t0) - (long)(g->at*1000);
+
+      if (aMatched[j] || (g->aData[0] != m->aData[0]) || ((m->len > 1) && (g->aData[1] != m->aData[1])) ||
+          ((m->len > 2) && (g->aData[2] != m->aData[2])) || (labs(error) > GOLDEN_TOLERANCE_US))
+        continue;
+      aMatched[j] = true;
+      if (labs(error) > labs(worst))
+        worst = error;
+      break;
+    }
+    if (j == sc->outCount)
+    {
+      if (!extra)
+        printf("    unexpected {%lu, {0x%02X, %u, %u}}\n", (m->us - t0 + 500) / 1000, m->aData[0], m->aData[1], m->aData[2]);
+      extra ++;
+    }
+  }
+  for (j = 0; j < sc->outCount; j++)
+  {
+    if (aMatched[j])
+      continue;
+    if (!missing)
+      printf("    missing {%lu, {0x%02X, %u, %u}}\n", sc->aOut[j].at, sc->aOut[j].aData[0], sc->aOut[j].aData[1], sc->aOut[j].aData[2]);
+    missing ++;
+  }
+  free(aMatched);
+
+  late = ProfileStats(eProfileLate);
+  cpu  = ProfileStats(eProfileLooper);
+  for (i = 0; i < PROFILE_BUCKETS; i++)
+    runs += cpu->aBuckets[i];
+  ok = !missing && !extra && (late->max <= GOLDEN_LATE_TICKS) && (cpu->over * (unsigned long)GOLDEN_CPU_SHARE <= runs);
+  printf("  %-20s %3u msgs  missing %u  unexpected %u  worst error %+5ld us  late %u ticks  LooperUpdate max %3u us, %u/%lu over%s\n",
+         sc->name, sc->outCount, missing, extra, worst, late->max, cpu->max, cpu->over, runs, ok ? "" : "  FAILED");
+  return ok;
+}
+
+int main(int argc, char ** argv)
+{
+  boolean print = (argc > 1) && !strcmp(argv[1], "-g");
+  unsigned int i;
+  int failed = 0;
+
+  if (!print)
+    printf("Golden traces : +-%d us, late <= %d ticks, LooperUpdate over budget <= 1/%d (host time)\n", GOLDEN_TOLERANCE_US, GOLDEN_LATE_TICKS, GOLDEN_CPU_SHARE);
+  for (i = 0; i < GOLDEN_SCENARIOS; i++)
+  {
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork(); //Fresh firmware state for each scenario
+    if (!pid)
+      return GoldenRun(&aScenarios[i], print) ? 0 : 1;
+    waitpid(pid, &status, 0);
+    failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+  }
+  return failed;
+}
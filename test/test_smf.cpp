@@ -0,0 +1,168 @@
+#include "Sim.h"
+#include "Looper.h"
+#include <stdio.h>
+
+/*
+-- Slots transfers test (SysEx, see LooperSMF.cpp) :
+  - busy : a loop is recorded on slot 1, then two dump requests are sent back to back. The first one must be
+    dumped (data packets, then result 0), the second one answered with result 1 : one transfer at a time
+  - open notes : a file whose last note has no NoteOff is loaded on slot 2. The load must succeed, and that note
+    must end at End of Track (duration from its NoteOn to the loop end), not be left with a 0 duration
+*/
+
+#define SMF_TEST_PASS_US 500      //loop() pass cost : timing is not checked here
+#define SMF_TEST_RUN_US  3000000  //Time given to a transfer (us)
+
+//Looper result packets and data packets seen in output, per slot
+typedef struct
+{
+  byte ok;
+  byte errors;
+  unsigned int packets;
+} tSMFTestOut;
+
+//Sends SysEx bytes from t, returns the date of the last one
+unsigned long SMFTestSysEx(unsigned long t, const byte * p, unsigned int len)
+{
+  unsigned int i;
+
+  for (i = 0; i < len; i++)
+    t = SimMIDIIn(t, p[i]);
+  return t;
+}
+
+//Scans output for the looper's packets (F0 7D 4D cmd slot ...) of slot
+void SMFTestScan(byte slot, tSMFTestOut * out)
+{
+  tSimByte * bytes;
+  unsigned int i, count = SimMIDIOut(&bytes);
+
+  memset(out, 0x00, sizeof(tSMFTestOut));
+  for (i = 0; i + 6 < count; i++)
+  {
+    if ((bytes[i].b != 0xF0) || (bytes[i+1].b != 0x7D) || (bytes[i+2].b != 0x4D) || (bytes[i+4].b != slot))
+      continue;
+    if (bytes[i+3].b == 0x02)
+      out->packets ++;
+    else if ((bytes[i+3].b == 0x03) && (bytes[i+6].b == 0xF7))
+    {
+      if (bytes[i+5].b)
+        out->errors ++;
+      else
+        out->ok ++;
+    }
+  }
+}
+
+boolean SMFTestBusy()
+{
+  const byte aRequest[] = {0xF0, 0x7D, 0x4D, 0x01, 0x00, 0xF7};
+  tSMFTestOut out;
+  unsigned long t;
+  boolean ok;
+  byte i;
+
+  //4 notes loop on slot 1
+  SimPress(1, 1200);
+  t = SimNow() + 10000;
+  for (i = 0; i < 2*4 + 1; i++)
+  {
+    SimMIDIInMsg(t + i*125000UL, 3, 0x90, 60 + (i % 4)*2, 100);
+    SimMIDIInMsg(t + i*125000UL + 60000, 3, 0x80, 60 + (i % 4)*2, 0x40);
+  }
+  SimRun(t + 10*125000UL);
+
+  SimMIDIOutClear();
+  t = SMFTestSysEx(SimNow() + 1000, aRequest, sizeof(aRequest));
+  SMFTestSysEx(t, aRequest, sizeof(aRequest));
+  SimRun(SimNow() + SMF_TEST_RUN_US);
+  SMFTestScan(0, &out);
+
+  ok = out.packets && (out.ok == 1) && (out.errors == 1);
+  printf("  busy : %u data packets, %u ok, %u error results (1 and 1)%s\n", out.packets, out.ok, out.errors, ok ? "" : "  FAILED");
+  return ok;
+}
+
+//Variable length quantity
+byte * SMFTestDelta(byte * p, unsigned long delta)
+{
+  if (delta >= 0x80)
+    *p++ = 0x80 | (delta >> 7);
+  *p++ = delta & 0x7F;
+  return p;
+}
+
+boolean SMFTestOpenNotes()
+{
+  byte aFile[64], aPacket[15];
+  byte * p = aFile;
+  byte * track;
+  unsigned int len, i, j;
+  unsigned long t;
+  tSMFTestOut out;
+  tStoreCursor cur;
+  tNoteEvent ev;
+  byte channel, size = 0, seq = 0;
+  unsigned int delay = 0, duration = 0;
+  boolean ok;
+
+  //Quarter note = 480 ticks : 60 from 0 to 240, 62 from 480 without NoteOff, End of Track at 960
+  const byte aHeader[] = {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xE0, 'M', 'T', 'r', 'k', 0, 0, 0, 0};
+  memcpy(p, aHeader, sizeof(aHeader));
+  p += sizeof(aHeader);
+  track = p;
+  p = SMFTestDelta(p, 0);   *p++ = 0x90; *p++ = 60; *p++ = 100;
+  p = SMFTestDelta(p, 240); *p++ = 0x80; *p++ = 60; *p++ = 0x40;
+  p = SMFTestDelta(p, 240); *p++ = 0x90; *p++ = 62; *p++ = 100;
+  p = SMFTestDelta(p, 480); *p++ = 0xFF; *p++ = 0x2F; *p++ = 0x00;
+  track[-1] = p - track;
+  len = p - aFile;
+
+  //One 7 bytes group per packet, as dumps
+  SimMIDIOutClear();
+  t = SimNow() + 1000;
+  for (i = 0; i < len; i += 7)
+  {
+    byte n = 7;
+
+    aPacket[0] = 0xF0; aPacket[1] = 0x7D; aPacket[2] = 0x4D; aPacket[3] = 0x02;
+    aPacket[4] = 1;
+    aPacket[5] = seq++;
+    aPacket[6] = 0;
+    for (j = 0; (j < 7) && (i + j < len); j++)
+    {
+      aPacket[6]    |= (aFile[i + j] >> 7) << j;
+      aPacket[n++]   = aFile[i + j] & 0x7F;
+    }
+    aPacket[n++] = 0xF7;
+    t = SMFTestSysEx(t, aPacket, n);
+  }
+  SimRun(t + SMF_TEST_RUN_US);
+  SMFTestScan(1, &out);
+
+  LooperSlotInfo(1, &channel, &size, &delay);
+  StoreRewind(&cur);
+  while (StoreNext(1, &cur, &ev))
+  {
+    if (ev.note == 62)
+      duration = ev.duration;
+  }
+  ok = (out.ok == 1) && !out.errors && (size == 2) && (delay == 480) && (duration == 480);
+  printf("  open notes : result %s, %u notes, loop end %u ticks after last note, last note %u ticks (480)%s\n",
+         out.ok ? "ok" : "error", size, delay, duration, ok ? "" : "  FAILED");
+  return ok;
+}
+
+int main()
+{
+  boolean ok;
+
+  SimPassCost(SMF_TEST_PASS_US, 0);
+  SimBoot();
+  SimRun(SimNow() + 100000);
+
+  printf("Slots transfers :\n");
+  ok = SMFTestBusy();
+  ok = SMFTestOpenNotes() && ok;
+  return ok ? 0 : 1;
+}